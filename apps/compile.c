@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 Microchip Technology Inc.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * This application loads a configuration file the same way as the planes
+ * application, and saves the resulting planes to a scene file that planes
+ * loads without going through the config, expressions and images again.
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "planes/engine.h"
+#include "planes/kms.h"
+
+static void usage(const char* base)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... SCENE\n", base);
+	fprintf(stderr, "Load a config file and save the planes to a scene file.\n\n");
+	fprintf(stderr, "  -h, --help\t\t\tShow this menu.\n");
+	fprintf(stderr, "  -c, --config=CONFIG\t\tSet the config file to read.\n");
+	fprintf(stderr, "  -d, --device=DEVICE\t\tSet the DRI device to open.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const char opts[] = "hoc:d:";
+	static struct option options[] = {
+		{ "help", no_argument, 0, 'h' },
+		{ "config", required_argument, 0, 'c' },
+		{ "device", required_argument, 0, 'd' },
+		{ "open", no_argument, 0, 'o' },
+		{ 0, 0, 0, 0 },
+	};
+	unsigned int i;
+	int opt, idx;
+	int fd;
+	int ret = 1;
+	const char* config_file = "default.config";
+	const char* device_file = "atmel-hlcdc";
+	uint32_t framedelay = 33;
+	struct kms_device* device;
+	struct plane_data** planes;
+	bool use_plain_open = false;
+
+	while ((opt = getopt_long(argc, argv, opts, options, &idx)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'c':
+			config_file = optarg;
+			break;
+		case 'd':
+			device_file = optarg;
+			break;
+		case 'o':
+			use_plain_open = true;
+			break;
+		default:
+			fprintf(stderr, "error: unknown option \"%c\"\n", opt);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (use_plain_open)
+		fd = open(device_file, O_RDWR, 0);
+	else
+		fd = drmOpen(device_file, NULL);
+	if (fd < 0) {
+		fprintf(stderr, "error: open() failed: %m\n");
+		return 1;
+	}
+
+	device = kms_device_open(fd);
+	if (!device)
+		return 1;
+
+	planes = calloc(device->num_planes, sizeof(struct plane_data*));
+
+	if (engine_load_config(config_file, device, planes, device->num_planes,
+			       &framedelay)) {
+		fprintf(stderr, "error: failed to load config file %s\n", config_file);
+	} else if (engine_save_scene(argv[optind], device, planes,
+				     device->num_planes, framedelay)) {
+		fprintf(stderr, "error: failed to save scene %s\n", argv[optind]);
+	} else {
+		ret = 0;
+	}
+
+	for (i = 0; i < device->num_planes;i++) {
+		if (planes[i])
+			plane_free(planes[i]);
+	}
+
+	kms_device_close(device);
+	drmClose(fd);
+	free(planes);
+
+	return ret;
+}
@@ -31,12 +31,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <libgen.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <xf86drm.h>
 
+#include "planes/draw.h"
 #include "planes/engine.h"
 #include "planes/kms.h"
 
@@ -46,34 +50,156 @@ static void usage(const char* base)
 	fprintf(stderr, "Load a config file, configure planes, and run the engine.\n\n");
 	fprintf(stderr, "  -h, --help\t\t\tShow this menu.\n");
 	fprintf(stderr, "  -v, --verbose\t\t\tShow verbose output.\n");
-	fprintf(stderr, "  -c, --config=CONFIG\t\tSet the config file to read.\n");
+	fprintf(stderr, "  -c, --config=CONFIG\t\tSet the config file, or a .scene file from planes-compile, to read.\n");
 	fprintf(stderr, "  -d, --device=DEVICE\t\tSet the DRI device to open.\n");
 	fprintf(stderr, "  -f, --frames=MAX_FRAMES\tSet the maximum number of frames to render and then exit.\n");
+	fprintf(stderr, "  -i, --image-cache=DIR\t\tKeep decoded images in DIR across runs.\n");
+	fprintf(stderr, "  -s, --vsync\t\t\tPace frames on the display vblank instead of sleeping.\n");
+	fprintf(stderr, "  -t, --stats\t\t\tPrint frame statistics on exit.\n");
+	fprintf(stderr, "  -w, --watch\t\t\tSwitch to the new config when the config file changes.\n");
 }
 
-static struct kms_device *device = NULL;
+static bool is_scene(const char* file)
+{
+	const char* ext = strrchr(file, '.');
 
-static void exit_handler(int s) {
-	kms_device_close(device);
-	exit(1);
+	return ext && !strcmp(ext, ".scene");
+}
+
+/* the number of vblanks closest to framedelay */
+static uint32_t vblank_divisor(struct kms_device* device, uint32_t framedelay)
+{
+	uint32_t vrefresh = device->screens[0]->mode.vrefresh;
+	uint32_t divisor = (framedelay * vrefresh + 500) / 1000;
+
+	return divisor ? divisor : 1;
+}
+
+/*
+ * Watch the directory of the config file, editors often replace files rather
+ * than write them.
+ */
+static int watch_config(const char* config_file)
+{
+	char* path = strdup(config_file);
+	int fd;
+
+	if (!path)
+		return -1;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd >= 0 &&
+	    inotify_add_watch(fd, dirname(path), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	free(path);
+
+	return fd;
+}
+
+static bool config_changed(int fd, const char* config_file)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char* path = strdup(config_file);
+	const char* name;
+	bool changed = false;
+	ssize_t len;
+
+	if (!path)
+		return false;
+
+	name = basename(path);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		char* p;
+
+		for (p = buf; p < buf + len;) {
+			struct inotify_event* event = (struct inotify_event*)p;
+
+			if (event->len && !strcmp(event->name, name))
+				changed = true;
+
+			p += sizeof(*event) + event->len;
+		}
+	}
+
+	free(path);
+
+	return changed;
+}
+
+static volatile sig_atomic_t interrupted;
+
+static void exit_handler(int s)
+{
+	interrupted = 1;
+}
+
+/*
+ * Run the engine until max_frames, if not zero, or until interrupted. With
+ * watch, switch to the new config whenever the config file changes.
+ */
+static void run(struct kms_device* device, struct plane_data** planes,
+		const char* config_file, uint32_t framedelay,
+		uint32_t max_frames, bool vsync, bool watch)
+{
+	uint32_t frame_count = 0;
+	int fd = -1;
+
+	if (watch) {
+		fd = watch_config(config_file);
+		if (fd < 0) {
+			fprintf(stderr, "error: can't watch %s: %m\n", config_file);
+			return;
+		}
+	}
+
+	/* start from a known vblank */
+	if (vsync)
+		kms_device_wait_vblank(device, 0);
+
+	while (!interrupted && (!max_frames || frame_count++ < max_frames)) {
+		if (fd >= 0 && config_changed(fd, config_file) &&
+		    engine_reload_config(config_file, device, planes,
+					 device->num_planes, &framedelay))
+			fprintf(stderr, "error: failed to reload config file %s\n",
+				config_file);
+
+		if (vsync)
+			engine_run_once_vsync(device, planes, device->num_planes,
+					      vblank_divisor(device, framedelay));
+		else
+			engine_run_once(device, planes, device->num_planes,
+					framedelay);
+	}
+
+	if (fd >= 0)
+		close(fd);
 }
 
 int main(int argc, char *argv[])
 {
-	static const char opts[] = "hvoc:d:f:";
+	static const char opts[] = "hvostwc:d:f:i:";
 	static struct option options[] = {
 		{ "help", no_argument, 0, 'h' },
 		{ "verbose", no_argument, 0, 'v' },
 		{ "config", required_argument, 0, 'c' },
 		{ "device", required_argument, 0, 'd' },
 		{ "frames", required_argument, 0, 'f' },
+		{ "image-cache", required_argument, 0, 'i' },
 		{ "open", no_argument, 0, 'o' },
+		{ "vsync", no_argument, 0, 's' },
+		{ "stats", no_argument, 0, 't' },
+		{ "watch", no_argument, 0, 'w' },
 		{ 0, 0, 0, 0 },
 	};
 	bool verbose = false;
 	unsigned int i;
 	int opt, idx;
 	int fd;
+	int err;
 	const char* config_file = "default.config";
 	const char* device_file = "atmel-hlcdc";
 	uint32_t framedelay = 33;
@@ -81,7 +207,11 @@ int main(int argc, char *argv[])
 	struct plane_data** planes;
 	struct stat s;
 	struct sigaction sig_handler;
+	struct kms_device* device;
+	bool stats = false;
 	bool use_plain_open = false;
+	bool vsync = false;
+	bool watch = false;
 
 	if (stat(config_file, &s) &&
 	    !stat("/usr/share/planes/default.config", &s)) {
@@ -105,9 +235,22 @@ int main(int argc, char *argv[])
 		case 'f':
 			max_frames = strtoll(optarg, NULL, 0);
 			break;
+		case 'i':
+			if (image_cache_set_dir(optarg))
+				return 1;
+			break;
 		case 'o':
 			use_plain_open = true;
 			break;
+		case 's':
+			vsync = true;
+			break;
+		case 't':
+			stats = true;
+			break;
+		case 'w':
+			watch = true;
+			break;
 		default:
 			fprintf(stderr, "error: unknown option \"%c\"\n", opt);
 			return 1;
@@ -119,6 +262,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* scenes have no config to reload */
+	if (watch && is_scene(config_file)) {
+		fprintf(stderr, "error: --watch can't be used with a scene\n");
+		return 1;
+	}
+
 	sig_handler.sa_handler = exit_handler;
 	sigemptyset(&sig_handler.sa_mask);
 	sig_handler.sa_flags = 0;
@@ -143,9 +292,20 @@ int main(int argc, char *argv[])
 
 	planes = calloc(device->num_planes, sizeof(struct plane_data*));
 
-	if (!engine_load_config(config_file, device, planes, device->num_planes, &framedelay)) {
-		engine_run(device, planes, device->num_planes, framedelay,
-			   max_frames);
+	if (is_scene(config_file))
+		err = engine_load_scene(config_file, device, planes,
+					device->num_planes, &framedelay);
+	else
+		err = engine_load_config(config_file, device, planes,
+					 device->num_planes, &framedelay);
+
+	if (!err) {
+		run(device, planes, config_file, framedelay, max_frames, vsync,
+		    watch);
+
+		/* not from the signal handler, printf() isn't safe there */
+		if (stats)
+			engine_stats_dump();
 	} else {
 		fprintf(stderr, "error: failed to load config file %s\n", config_file);
 	}
@@ -155,9 +315,12 @@ int main(int argc, char *argv[])
 			plane_free(planes[i]);
 	}
 
+	/* framebuffers left over by the last reload */
+	plane_fb_pool_clear();
+
 	kms_device_close(device);
 	drmClose(fd);
 	free(planes);
 
-	return 0;
+	return interrupted ? 1 : 0;
 }
@@ -27,6 +27,10 @@
  * This is a basic drawing API that uses Cairo as the backend.  This is used by
  * the engine, and can be used directly, but for more advanced graphics another
  * framework should be used.
+ *
+ * Cairo draws straight into RGB565, XRGB8888 and ARGB8888 framebuffers. Other
+ * packed RGB formats and the YUV formats are drawn in an ARGB32 copy of the
+ * framebuffer, and only the area that changed is converted back.
  */
 #ifndef PLANES_DRAW_H
 #define PLANES_DRAW_H
@@ -52,6 +56,48 @@ extern "C" {
 int render_fb_text(struct kms_framebuffer* fb, int x, int y, const char* text,
 		   uint32_t color, float size);
 
+/**
+ * Glyphs of a font rasterised once, for render_fb_text_atlas().
+ */
+struct text_atlas;
+
+/**
+ * Rasterise the printable ASCII glyphs of the text font at the given size.
+ *
+ * @param size Font size.
+ * @return The atlas, to be freed with text_atlas_free(), or NULL on error.
+ */
+struct text_atlas* text_atlas_create(float size);
+
+/**
+ * Free an atlas created with text_atlas_create().
+ *
+ * @param atlas The atlas.
+ */
+void text_atlas_free(struct text_atlas* atlas);
+
+/**
+ * Render text by blending glyphs from an atlas in the framebuffer.
+ *
+ * This is meant for text updated often, such as live values. Glyphs are placed
+ * on whole pixels without kerning, and characters outside of printable ASCII
+ * are skipped.
+ *
+ * @param fb The framebuffer.
+ * @param atlas The glyph atlas.
+ * @param x X coordinate.
+ * @param y Y coordinate of the baseline.
+ * @param text The text to render.
+ * @param color RGBA color of the text.
+ * @param background RGBA color the previous text is cleared with.
+ * @param box If not NULL, the area of the text previously drawn here, cleared
+ *            before drawing and updated to the area of the new text. Zero it
+ *            before the first call.
+ */
+int render_fb_text_atlas(struct kms_framebuffer* fb, struct text_atlas* atlas,
+			 int x, int y, const char* text, uint32_t color,
+			 uint32_t background, struct drm_mode_rect* box);
+
 /**
  * Render a checker pattern to the framebuffer.
  *
@@ -90,6 +136,24 @@ int render_fb_vgradient(struct kms_framebuffer* fb, uint32_t color1,
  */
 int render_fb_image(struct kms_framebuffer* fb, const char* filename);
 
+/**
+ * Choose a directory where decoded and scaled images are kept across runs.
+ *
+ * render_fb_image() keeps the last images it decoded in memory, up to 16 MiB.
+ * engine_load_config() releases them once the planes are drawn. With a cache
+ * directory, it also stores them there and reads them back instead of decoding
+ * the file again. By default the directory is taken from the
+ * LIBPLANES_IMAGE_CACHE environment variable.
+ *
+ * @param dir The directory, created if needed, or NULL to only cache in memory.
+ */
+int image_cache_set_dir(const char* dir);
+
+/**
+ * Release the images kept in memory by render_fb_image().
+ */
+void image_cache_clear(void);
+
 /**
  * Load and render a raw image file to the framebuffer (memcpy).
  *
@@ -101,6 +165,8 @@ int render_fb_image_raw(struct kms_framebuffer* fb, const char* filename);
 /**
  * Transform flip the framebuffer horizontaly.
  *
+ * 16 and 32 bpp formats are flipped in place, others go through cairo.
+ *
  * @param fb The framebuffer.
  */
 int flip_fb_horizontal(struct kms_framebuffer* fb);
@@ -112,6 +178,34 @@ int flip_fb_horizontal(struct kms_framebuffer* fb);
  */
 int flip_fb_vertical(struct kms_framebuffer* fb);
 
+/**
+ * Flip a rectangle of the framebuffer horizontaly, leaving the rest as is.
+ *
+ * The rectangle is clipped to the framebuffer.
+ *
+ * @param fb The framebuffer.
+ * @param x X coordinate of the rectangle.
+ * @param y Y coordinate of the rectangle.
+ * @param width Width of the rectangle.
+ * @param height Height of the rectangle.
+ */
+int flip_fb_horizontal_rect(struct kms_framebuffer* fb, int x, int y,
+			    int width, int height);
+
+/**
+ * Flip a rectangle of the framebuffer vertically, leaving the rest as is.
+ *
+ * The rectangle is clipped to the framebuffer.
+ *
+ * @param fb The framebuffer.
+ * @param x X coordinate of the rectangle.
+ * @param y Y coordinate of the rectangle.
+ * @param width Width of the rectangle.
+ * @param height Height of the rectangle.
+ */
+int flip_fb_vertical_rect(struct kms_framebuffer* fb, int x, int y,
+			  int width, int height);
+
 #ifdef __cplusplus
 }
 #endif
@@ -87,6 +87,8 @@ enum {
 	TRANSFORM_FLIP_VERTICAL = (1<<1),
 	TRANSFORM_ROTATE_CLOCKWISE = (1<<2),
 	TRANSFORM_ROTATE_CCLOCKWISE = (1<<3),
+	/** Render flips once at load time and switch framebuffers at triggers. */
+	TRANSFORM_PRERENDER = (1<<4),
 };
 
 /**
@@ -106,6 +108,59 @@ int engine_load_config(const char* config_file, struct kms_device *device,
 		       struct plane_data** planes, uint32_t num_planes,
 		       uint32_t* framedelay);
 
+/**
+ * Replace the planes with those of another config file, without stopping.
+ *
+ * The new planes reuse the framebuffers the previous reload freed when their
+ * size and format match. Planes that are not part of the new config are
+ * disabled, and the switch is done in a single commit, checked as a whole
+ * beforehand. The call returns once the new planes are on screen, and the old
+ * ones are freed.
+ *
+ * @param config_file Config file path to parse.
+ * @param device The KMS device.
+ * @param planes Array of the current planes, updated with the new ones.
+ * @param num_planes Number of planes in array.
+ * @param framedelay Resulting delay in milliseconds for each frame.
+ * @return 0 on success. On error the current planes are left as they are.
+ */
+int engine_reload_config(const char* config_file, struct kms_device* device,
+			 struct plane_data** planes, uint32_t num_planes,
+			 uint32_t* framedelay);
+
+/**
+ * Save the planes as they are after engine_load_config() to a scene file.
+ *
+ * A scene holds the resolved plane parameters and the content of the
+ * framebuffers in the plane format, so it loads without parsing the config,
+ * running expressions or decoding images. Scenes only load on a device with
+ * the same screen size and framebuffer layout.
+ *
+ * @param scene_file Scene file path to write.
+ * @param device The KMS device the planes were created on.
+ * @param planes Array of plane_data pointers.
+ * @param num_planes Number of planes in array.
+ * @param framedelay Delay in milliseconds for each frame.
+ */
+int engine_save_scene(const char* scene_file, struct kms_device* device,
+		      struct plane_data** planes, uint32_t num_planes,
+		      uint32_t framedelay);
+
+/**
+ * Load a scene saved with engine_save_scene() and populate the planes array.
+ *
+ * @note This will overwrite anything that may already be in the array.
+ *
+ * @param scene_file Scene file path to read.
+ * @param device The already created KMS device.
+ * @param planes Pre-allocated array.
+ * @param num_planes Number of planes in array.
+ * @param framedelay Resulting delay in milliseconds for each frame.
+ */
+int engine_load_scene(const char* scene_file, struct kms_device* device,
+		      struct plane_data** planes, uint32_t num_planes,
+		      uint32_t* framedelay);
+
 /**
  * Run the engine over the configurd planes array until max_frames is reached if
  * it is a positive value.
@@ -132,6 +187,92 @@ void engine_run(struct kms_device* device, struct plane_data** planes,
 void engine_run_once(struct kms_device* device, struct plane_data** planes,
 		     uint32_t num_planes, uint32_t framedelay);
 
+/**
+ * Run the engine paced on the display vblank until max_frames is reached if it
+ * is a positive value.
+ *
+ * Each frame is committed with a page flip event and the next frame is only
+ * built once the kernel reports the previous one on screen, instead of sleeping
+ * for a fixed delay.
+ *
+ * @param device The already created KMS device.
+ * @param planes Array of plane_data pointers.
+ * @param num_planes Number of planes in array.
+ * @param vblank_divisor Number of vblanks per frame, 1 to update on every vblank.
+ * @param max_frames The maximum number of frames to run befoe returning.
+ */
+void engine_run_vsync(struct kms_device* device, struct plane_data** planes,
+		      uint32_t num_planes, uint32_t vblank_divisor,
+		      uint32_t max_frames);
+
+/**
+ * Execute a single vblank paced frame of the engine.
+ *
+ * @param device The already created KMS device.
+ * @param planes Array of plane_data pointers.
+ * @param num_planes Number of planes in array.
+ * @param vblank_divisor Number of vblanks per frame, 1 to update on every vblank.
+ * @see engine_run_vsync()
+ */
+void engine_run_once_vsync(struct kms_device* device, struct plane_data** planes,
+			   uint32_t num_planes, uint32_t vblank_divisor);
+
+/** Number of frame interval histogram buckets, one per millisecond. */
+#define ENGINE_STATS_BUCKETS 64
+
+/**
+ * @brief Engine frame statistics.
+ *
+ * Times are in nanoseconds and accumulated over all frames since the last
+ * engine_stats_reset().
+ */
+struct engine_stats
+{
+	/** Number of frames run. */
+	uint64_t frames;
+	/** Time spent moving planes and computing their new state. */
+	uint64_t update_ns;
+	/** Time spent in framebuffer transforms, such as flip_fb_horizontal(). */
+	uint64_t transform_ns;
+	/** Time spent in plane_apply(), publishing the new plane states. */
+	uint64_t stage_ns;
+	/** Time spent building the atomic requests from the plane states. */
+	uint64_t build_ns;
+	/** Time spent in kms_device_flush() sending the requests. */
+	uint64_t commit_ns;
+	/** Longest frame, from its start to its commit (or flip in vsync mode). */
+	uint64_t max_frame_ns;
+	/** Frames that overran framedelay, or missed their vblank in vsync mode. */
+	uint32_t missed_deadlines;
+	/** Failed commits. */
+	uint32_t commit_errors;
+	/**
+	 * Histogram of the intervals between frame starts. Bucket i counts the
+	 * intervals from i to i + 1 milliseconds, the last bucket everything
+	 * longer.
+	 */
+	uint32_t intervals[ENGINE_STATS_BUCKETS];
+	/** Start of the last frame, CLOCK_MONOTONIC. */
+	uint64_t last_start_ns;
+};
+
+/**
+ * Get the engine statistics.
+ *
+ * @param stats Filled with the statistics.
+ */
+void engine_stats_get(struct engine_stats* stats);
+
+/**
+ * Reset the engine statistics.
+ */
+void engine_stats_reset(void);
+
+/**
+ * Print the engine statistics on the standard output.
+ */
+void engine_stats_dump(void);
+
 /**
  * @brief RGBA color broken out into floating point components.
  */
@@ -38,6 +38,10 @@
 extern "C" {
 #endif
 
+struct kms_test_entry;
+struct kms_plane_state;
+struct kms_commit_worker;
+
 struct kms_device {
 	int fd;
 
@@ -53,6 +57,32 @@ struct kms_device {
 	drmModeAtomicReqPtr atomic_request;
 	pthread_mutex_t req_lock;
 	bool modeset_needed;
+
+	/*
+	 * flip_pending, commit_seq and retired_seq are written by the commit
+	 * thread while it runs, read them with __atomic_load_n().
+	 */
+	/** A commit requesting a page flip event has not completed yet. */
+	bool flip_pending;
+	/** Sequence number of the last vblank reported by the kernel. */
+	unsigned int vblank_sequence;
+	/** CLOCK_MONOTONIC timestamp in nanoseconds of that vblank. */
+	uint64_t vblank_time_ns;
+	/** Number of successful commits. */
+	unsigned int commit_seq;
+	/** Number of commits known to be latched by the hardware. */
+	unsigned int retired_seq;
+	/**
+	 * Time in nanoseconds the last flush spent building the atomic request,
+	 * before handing it to the kernel.
+	 */
+	uint64_t build_ns;
+
+	/** Memoised results of plane configuration checks. */
+	struct kms_test_entry *test_cache;
+
+	/** Commit thread, see kms_device_start_commit_thread(). */
+	struct kms_commit_worker *commit_worker;
 };
 
 /**
@@ -79,10 +109,162 @@ void kms_device_dump(struct kms_device *device);
 /**
  * Commit the DRM state changes.
  *
+ * The commit is always non blocking. If flags contains
+ * DRM_MODE_PAGE_FLIP_EVENT, a commit is sent even without any pending state
+ * change and the kernel will signal when it has been latched by the hardware.
+ * Use kms_device_wait_flip() to wait for it.
+ *
+ * Plane changes are published without locking and gathered here, so threads
+ * updating different planes never wait for each other or for a flush. Each
+ * plane contributes the latest complete state its producer has published.
+ *
  * @param device The KMS device.
+ * @param flags Zero or DRM_MODE_PAGE_FLIP_EVENT.
  */
 int kms_device_flush(struct kms_device *device, uint32_t flags);
 
+/**
+ * Commit the DRM state changes and get a fence for the commit.
+ *
+ * Same as kms_device_flush(), but when out_fence is not NULL a commit is always
+ * sent and out_fence is set to a sync file descriptor, through the CRTC
+ * OUT_FENCE_PTR property. The fence is signaled when the commit has been
+ * latched by the hardware. It can be polled, or waited for with
+ * kms_fence_wait(), and must be closed by the caller.
+ *
+ * @param device The KMS device.
+ * @param flags Zero or DRM_MODE_PAGE_FLIP_EVENT.
+ * @param out_fence Where to store the fence, -1 if the commit failed. Can be
+ *                  NULL.
+ */
+int kms_device_flush_fence(struct kms_device *device, uint32_t flags,
+			   int *out_fence);
+
+/**
+ * Wait for a fence to be signaled.
+ *
+ * The fence is not closed.
+ *
+ * @param fence_fd The sync file descriptor.
+ * @param timeout_ms Maximum time to wait in milliseconds, -1 for no timeout.
+ * @return 0 once signaled, -ETIMEDOUT or another negative error code otherwise.
+ */
+int kms_fence_wait(int fence_fd, int timeout_ms);
+
+/**
+ * Check if the pending DRM state changes would be accepted, without committing
+ * them.
+ *
+ * This runs a DRM_MODE_ATOMIC_TEST_ONLY commit, including the modeset if it
+ * hasn't been done yet. The pending state is kept as is.
+ *
+ * @param device The KMS device.
+ * @return 0 if the state is supported, a negative error code otherwise.
+ */
+int kms_device_test(struct kms_device *device);
+
+/**
+ * Wait for the completion of a commit flushed with DRM_MODE_PAGE_FLIP_EVENT.
+ *
+ * On success, vblank_sequence and vblank_time_ns are updated with the vblank
+ * the commit has been latched on.
+ *
+ * @param device The KMS device.
+ * @param timeout_ms Maximum time to wait in milliseconds, -1 for no timeout.
+ */
+int kms_device_wait_flip(struct kms_device *device, int timeout_ms);
+
+/**
+ * Callback reporting the outcome of a frame queued with
+ * kms_device_queue_commit().
+ *
+ * It runs in the commit thread.
+ *
+ * @param device The KMS device.
+ * @param frame The frame number.
+ * @param status 0 once the frame is on screen, a negative error code if its
+ *               commit failed.
+ * @param user_data The pointer given to kms_device_start_commit_thread().
+ */
+typedef void (*kms_commit_cb)(struct kms_device *device, unsigned int frame,
+			      int status, void *user_data);
+
+/**
+ * Start a thread committing the frames queued with kms_device_queue_commit().
+ *
+ * Each commit requests a page flip event and the thread waits for it before
+ * sending the next one, so all the frames queued within a vblank end up in a
+ * single commit of the newest state. A commit the kernel rejects with -EBUSY
+ * is sent again after the pending one completes.
+ *
+ * While the thread runs, it is the only one that should flush the device or
+ * wait for page flips.
+ *
+ * @param device The KMS device.
+ * @param callback Called for every frame once it is done, can be NULL.
+ * @param user_data Passed to the callback.
+ */
+int kms_device_start_commit_thread(struct kms_device *device,
+				   kms_commit_cb callback, void *user_data);
+
+/**
+ * Stop the commit thread.
+ *
+ * The frame being committed is finished, frames queued after it are dropped
+ * without being reported. This is also done by kms_device_close().
+ *
+ * @param device The KMS device.
+ */
+void kms_device_stop_commit_thread(struct kms_device *device);
+
+/**
+ * Queue the state staged so far for the commit thread.
+ *
+ * This never blocks on the DRM device.
+ *
+ * @param device The KMS device.
+ * @param frame Where to store the frame number given to the callback, can be
+ *              NULL.
+ */
+int kms_device_queue_commit(struct kms_device *device, unsigned int *frame);
+
+/**
+ * Wait until every commit sent so far has been latched by the hardware.
+ *
+ * Afterwards retired_seq equals commit_seq. Commits flushed without
+ * DRM_MODE_PAGE_FLIP_EVENT can't be tracked, so for those this waits for two
+ * vblanks.
+ *
+ * @param device The KMS device.
+ * @param timeout_ms Maximum time to wait for a page flip event in
+ *                   milliseconds, -1 for no timeout.
+ */
+int kms_device_wait_idle(struct kms_device *device, int timeout_ms);
+
+/**
+ * Wait for the vblank with the given sequence number on the first CRTC.
+ *
+ * If this vblank has already passed, wait for the next one. On success,
+ * vblank_sequence and vblank_time_ns are updated.
+ *
+ * @param device The KMS device.
+ * @param sequence Absolute vblank sequence number.
+ */
+int kms_device_wait_vblank(struct kms_device *device, unsigned int sequence);
+
+/** Maximum number of rectangles kept by struct kms_damage. */
+#define KMS_DAMAGE_MAX 8
+
+/**
+ * Damaged area of a framebuffer, as a list of rectangles in framebuffer
+ * coordinates. When the list is full, the rectangles are merged in their
+ * bounding box.
+ */
+struct kms_damage {
+	struct drm_mode_rect rects[KMS_DAMAGE_MAX];
+	unsigned int count;
+};
+
 struct kms_framebuffer {
 	struct kms_device *device;
 
@@ -98,6 +280,17 @@ struct kms_framebuffer {
 	int prime_fd;
 
 	void *ptr;
+	/** Number of users of the mapping. */
+	unsigned int map_count;
+	/** Keep the mapping when the last user is gone, true by default. */
+	bool map_persistent;
+
+	/** Area changed since it was last handed to a plane. */
+	struct kms_damage damage;
+
+	/** Drawing state cached by the draw API, released with the mapping. */
+	void *draw_data;
+	void (*draw_free)(void *draw_data);
 };
 
 struct drm_object;
@@ -125,6 +318,9 @@ struct kms_plane {
 
 	uint32_t *formats;
 	unsigned int num_formats;
+
+	/** Pending state, published without locking and gathered on flush. */
+	struct kms_plane_state *state;
 };
 
 /**
@@ -38,7 +38,22 @@ struct kms_plane;
 struct kms_framebuffer;
 struct kms_device;
 
-#define MAX_TEXT_STR_LEN 2048
+/**
+ * @brief Text drawn on a plane by the demo engine.
+ */
+struct plane_text
+{
+	/** The text. */
+	char* str;
+	/** X coordinate. */
+	int x;
+	/** Y coordinate of the baseline. */
+	int y;
+	/** RGBA color. */
+	uint32_t color;
+	/** Font size. */
+	float size;
+};
 
 /**
  * @brief Plane configuration.
@@ -64,7 +79,16 @@ struct plane_data
 	void** bufs;
 	/** The DRM PRIME file descriptor. Must call plane_fb_export() to set this. */
 	int* prime_fds;
+	/** Index of the framebuffer last selected for display. */
 	unsigned int front_buf;
+	/** Index of the framebuffer the hardware is known to scan out. */
+	unsigned int scanout_buf;
+	/** Bitmask of the framebuffers handed out by plane_acquire(). */
+	uint32_t acquired;
+	/** Bitmask of the framebuffers selected for display but not on screen yet. */
+	uint32_t queued;
+	/** Commit sequence number each framebuffer has been selected for. */
+	unsigned int* queue_seqs;
 	/** The number of framebuffers. */
 	uint32_t buffer_count;
 	/** Plane type index, starting at zero. */
@@ -88,6 +112,10 @@ struct plane_data
 	int move_flags;
 	int transform_flags;
 
+	/** State the engine attaches to the plane, freed with engine_free. */
+	void* engine_data;
+	void (*engine_free)(void* data);
+
 	struct
 	{
 		int xspeed;
@@ -127,14 +155,10 @@ struct plane_data
 		int runningspeed;
 	} sprite;
 
-	struct
-	{
-		char str[MAX_TEXT_STR_LEN];
-		int x;
-		int y;
-		uint32_t color;
-		float size;
-	} text[255];
+	/** Text entries, added with plane_add_text(). */
+	struct plane_text* text;
+	/** The number of text entries. */
+	unsigned int text_count;
 };
 
 /**
@@ -155,7 +179,8 @@ struct plane_data* plane_create(struct kms_device* device, int type, int index,
  * Create a plane with one of more framebuffers.
  *
  * When more than one framebuffer is allocated, plane_flip() can be used to
- * iterate through them on the plane.
+ * iterate through them on the plane, or plane_acquire() and plane_queue() can
+ * be used to render without touching the framebuffer on screen.
  *
  * @param device The already created KMS device.
  * @param type The type of plane: DRM_PLANE_TYPE_PRIMARY,DRM_PLANE_TYPE_OVERLAY,
@@ -164,7 +189,7 @@ struct plane_data* plane_create(struct kms_device* device, int type, int index,
  * @param width The width in pixels of the plane.
  * @param height The height in pixels of the plane.
  * @param format A DRM format, or zero to automatically choose.
- * @param buffer_count The number of buffers to allocate.
+ * @param buffer_count The number of buffers to allocate, at most 32.
  */
 struct plane_data* plane_create_buffered(struct kms_device* device, int type,
 					 int index, int width, int height,
@@ -177,6 +202,37 @@ struct plane_data* plane_create_buffered(struct kms_device* device, int type,
  */
 void plane_free(struct plane_data* plane);
 
+/**
+ * Free a plane, but keep its framebuffers for reuse.
+ *
+ * The next plane_create() or plane_create_buffered() calls take these
+ * framebuffers when the size and format match, instead of allocating new ones.
+ * Their content is left as is. The framebuffers must not be on screen anymore.
+ *
+ * @param plane The plane.
+ */
+void plane_free_pooled(struct plane_data* plane);
+
+/**
+ * Free the framebuffers kept by plane_free_pooled() that were not reused.
+ *
+ * This must be called before the device they belong to is closed.
+ */
+void plane_fb_pool_clear(void);
+
+/**
+ * Add a text entry to the plane.
+ *
+ * @param plane The plane.
+ * @param str The text, copied.
+ * @param x X coordinate.
+ * @param y Y coordinate of the baseline.
+ * @param color RGBA color.
+ * @param size Font size.
+ */
+int plane_add_text(struct plane_data* plane, const char* str, int x, int y,
+		   uint32_t color, float size);
+
 /**
  * Set the rotate value of the plane.
  *
@@ -247,7 +303,24 @@ double plane_scale_y(struct plane_data* plane);
 int plane_apply(struct plane_data* plane);
 
 /**
- * Immediately apply the rotate value.
+ * Check if the hardware supports the current configuration of the plane.
+ *
+ * The framebuffer, position, scale, pan, rotate and alpha values are tested
+ * with a DRM test only commit, nothing is applied. Results are remembered, so
+ * checking the same configuration again doesn't involve the kernel.
+ *
+ * @note Each plane is checked alone on top of the current display state.
+ *
+ * @param plane The plane.
+ * @return 0 if the configuration is supported, a negative error code otherwise.
+ */
+int plane_check(struct plane_data* plane);
+
+/**
+ * Apply the rotate value.
+ *
+ * The change is added to the pending atomic request and reaches the screen with
+ * the next kms_device_flush(), along with the rest of the frame.
  *
  * @param plane The plane.
  * @param degrees Rotation degrees of the plane.
@@ -255,12 +328,46 @@ int plane_apply(struct plane_data* plane);
 int plane_apply_rotate(struct plane_data* plane, uint32_t degrees);
 
 /**
- * Immediately apply the alpha value.
+ * Apply the alpha value.
+ *
+ * The change is added to the pending atomic request and reaches the screen with
+ * the next kms_device_flush(), along with the rest of the frame.
  *
  * @param plane The plane.
  */
 int plane_apply_alpha(struct plane_data* plane, uint32_t alpha);
 
+/**
+ * Apply any other plane property by its DRM name.
+ *
+ * Like plane_apply_alpha(), the change is committed by the next
+ * kms_device_flush().
+ *
+ * @param plane The plane.
+ * @param name The DRM property name.
+ * @param value The property value.
+ */
+int plane_apply_property(struct plane_data* plane, const char* name,
+			 uint32_t value);
+
+/**
+ * Make the next commit of the plane wait for a fence.
+ *
+ * The kernel won't display the new plane state before the fence, for example
+ * the sync file of a GPU job rendering into the framebuffer, is signaled. Like
+ * plane_apply_alpha(), this goes with the next kms_device_flush(). The kernel
+ * takes its own reference to the fence, so it can be closed after a successful
+ * flush. If the flush fails, the fence is kept for the next one and must stay
+ * open until then.
+ *
+ * Only one fence can wait for a flush: the call fails while there is already
+ * one.
+ *
+ * @param plane The plane.
+ * @param fence_fd The sync file descriptor.
+ */
+int plane_set_in_fence(struct plane_data* plane, int fence_fd);
+
 /**
  * Get the plane width.
  * @param plane The plane.
@@ -374,10 +481,42 @@ int plane_fb_map(struct plane_data* plane);
 /**
  * Opposite of plane_fb_map().
  *
+ * The framebuffers stay mapped for the draw API if they are in persistent
+ * mode.
+ *
  * @param plane The plane.
  */
 void plane_fb_unmap(struct plane_data* plane);
 
+/**
+ * Tell which area of a framebuffer was changed through plane_fb_map().
+ *
+ * The draw API does this by itself. Damage is accumulated until the
+ * framebuffer is next applied or flipped to, and is then passed to the kernel
+ * with the FB_DAMAGE_CLIPS plane property when the driver supports it.
+ *
+ * @param plane The plane.
+ * @param index Index of the framebuffer.
+ * @param x X coordinate of the changed area.
+ * @param y Y coordinate of the changed area.
+ * @param width Width of the changed area.
+ * @param height Height of the changed area.
+ */
+void plane_fb_damage(struct plane_data* plane, uint32_t index, int x, int y,
+		     int width, int height);
+
+/**
+ * Choose whether the framebuffers stay mapped when nobody uses them.
+ *
+ * Framebuffers are persistent by default, so repeated draws don't map and
+ * unmap them each time. Turn it off to release the mappings as soon as the
+ * last draw call or plane_fb_unmap() is done with them.
+ *
+ * @param plane The plane.
+ * @param persistent Keep the mappings.
+ */
+void plane_fb_set_persistent(struct plane_data* plane, bool persistent);
+
 /**
  * Export the framebuffer using a DRM PRIME file descriptor.
  *
@@ -421,6 +560,60 @@ int plane_fb_reallocate(struct plane_data* plane,
  */
 int plane_flip(struct plane_data* plane, uint32_t target);
 
+/**
+ * Acquire a back buffer to render into.
+ *
+ * The returned framebuffer is neither on screen nor waiting to be, and stays
+ * reserved until it is given to plane_queue() or plane_release(). Its content
+ * is whatever was last rendered into it.
+ *
+ * Framebuffers are released automatically once the one queued after them is
+ * latched by the hardware. If none is free, this waits for pending commits
+ * with kms_device_wait_idle(), or for the commit thread to retire one when it
+ * runs. With two framebuffers this typically means waiting for the previous
+ * frame to reach the screen, a third one lets rendering go on in the meantime.
+ *
+ * The swapchain calls of a plane must all be made from the same thread, which
+ * can be another one than the commit thread.
+ *
+ * @param plane The plane.
+ * @return The framebuffer index, or a negative error code. -EBUSY is returned
+ *         when the plane has a single framebuffer or when all of them are held
+ *         by the caller or queued and not flushed yet.
+ */
+int plane_acquire(struct plane_data* plane);
+
+/**
+ * Queue an acquired framebuffer for display.
+ *
+ * This is plane_flip() for a buffer obtained with plane_acquire(). It reaches
+ * the screen with the next kms_device_flush().
+ *
+ * @param plane The plane.
+ * @param index The framebuffer index returned by plane_acquire().
+ */
+int plane_queue(struct plane_data* plane, uint32_t index);
+
+/**
+ * Give back an acquired framebuffer without displaying it.
+ *
+ * @param plane The plane.
+ * @param index The framebuffer index returned by plane_acquire().
+ */
+void plane_release(struct plane_data* plane, uint32_t index);
+
+/**
+ * Copy the content of a framebuffer of the plane to another one.
+ *
+ * This is typically used to start rendering an acquired back buffer from what
+ * is currently on screen.
+ *
+ * @param plane The plane.
+ * @param dst The destination framebuffer index.
+ * @param src The source framebuffer index.
+ */
+int plane_fb_copy(struct plane_data* plane, uint32_t dst, uint32_t src);
+
 /**
  * Same as plane_flip(), but it does it immediately irrelevant of vsync.
  */
@@ -6,7 +6,13 @@
 #include <planes/draw.h>
 %}
 
-typedef unsigned int uint32_t;
+%include <typemaps.i>
+
+%include <stdint.i>
+
+/* kms_device_flush_fence() returns the fence along with the error code */
+%apply int *OUTPUT { int *out_fence };
+%apply unsigned int *OUTPUT { unsigned int *frame };
 
 %include <planes/kms.h>
 %include <planes/plane.h>
@@ -40,3 +46,10 @@ typedef unsigned int uint32_t;
 		return *($self->fbs[index]);
 	}
 }
+
+%extend engine_stats {
+	uint32_t interval(int index)
+	{
+		return $self->intervals[index];
+	}
+}
@@ -28,7 +28,8 @@ def run():
                    "window.config"]
     while not abort:
         for config in configs:
-            proc = Popen(["planes", "-f", "500", "-c", config], close_fds=True)
+            proc = Popen(["planes", "-f", "500", "-i", "/tmp/planes-images",
+                          "-c", config], close_fds=True)
             child_pid = proc.pid
             proc.wait()
             if abort:
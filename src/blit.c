@@ -0,0 +1,957 @@
+/*
+ * Copyright (C) 2026 Microchip Technology Inc.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <drm_fourcc.h>
+
+#include "blit.h"
+#include "common.h"
+
+/* bytes of a row swapped at once by the vertical flip */
+#define SWAP_CHUNK 512
+
+/*
+ * Reverse the pixels from l to r, both included. Blocks are taken from both
+ * ends and swapped reversed until they would overlap, the middle is done one
+ * pixel at a time.
+ */
+static void reverse_row32(uint32_t *l, uint32_t *r)
+{
+#if defined(__ARM_NEON)
+	while (r - l >= 7) {
+		uint32x4_t a = vld1q_u32(l);
+		uint32x4_t b = vld1q_u32(r - 3);
+
+		a = vrev64q_u32(a);
+		a = vcombine_u32(vget_high_u32(a), vget_low_u32(a));
+		b = vrev64q_u32(b);
+		b = vcombine_u32(vget_high_u32(b), vget_low_u32(b));
+
+		vst1q_u32(l, b);
+		vst1q_u32(r - 3, a);
+		l += 4;
+		r -= 4;
+	}
+#elif defined(__SSE2__)
+	while (r - l >= 7) {
+		__m128i a = _mm_loadu_si128((__m128i *)l);
+		__m128i b = _mm_loadu_si128((__m128i *)(r - 3));
+
+		a = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3));
+		b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+
+		_mm_storeu_si128((__m128i *)l, b);
+		_mm_storeu_si128((__m128i *)(r - 3), a);
+		l += 4;
+		r -= 4;
+	}
+#endif
+	while (l < r) {
+		uint32_t t = *l;
+
+		*l++ = *r;
+		*r-- = t;
+	}
+}
+
+static void reverse_row16(uint16_t *l, uint16_t *r)
+{
+#if defined(__ARM_NEON)
+	while (r - l >= 15) {
+		uint16x8_t a = vld1q_u16(l);
+		uint16x8_t b = vld1q_u16(r - 7);
+
+		a = vrev64q_u16(a);
+		a = vcombine_u16(vget_high_u16(a), vget_low_u16(a));
+		b = vrev64q_u16(b);
+		b = vcombine_u16(vget_high_u16(b), vget_low_u16(b));
+
+		vst1q_u16(l, b);
+		vst1q_u16(r - 7, a);
+		l += 8;
+		r -= 8;
+	}
+#elif defined(__SSE2__)
+	while (r - l >= 15) {
+		__m128i a = _mm_loadu_si128((__m128i *)l);
+		__m128i b = _mm_loadu_si128((__m128i *)(r - 7));
+
+		a = _mm_shufflelo_epi16(a, _MM_SHUFFLE(0, 1, 2, 3));
+		a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(0, 1, 2, 3));
+		a = _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2));
+		b = _mm_shufflelo_epi16(b, _MM_SHUFFLE(0, 1, 2, 3));
+		b = _mm_shufflehi_epi16(b, _MM_SHUFFLE(0, 1, 2, 3));
+		b = _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2));
+
+		_mm_storeu_si128((__m128i *)l, b);
+		_mm_storeu_si128((__m128i *)(r - 7), a);
+		l += 8;
+		r -= 8;
+	}
+#endif
+	while (l < r) {
+		uint16_t t = *l;
+
+		*l++ = *r;
+		*r-- = t;
+	}
+}
+
+int blit_flip_horizontal(void *ptr, unsigned int pitch, unsigned int bpp,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height)
+{
+	uint8_t *row = (uint8_t *)ptr + y * pitch + x * (bpp / 8);
+	unsigned int i;
+
+	if (bpp != 16 && bpp != 32)
+		return -EINVAL;
+
+	if (width < 2)
+		return 0;
+
+	for (i = 0; i < height; i++, row += pitch) {
+		if (bpp == 32)
+			reverse_row32((uint32_t *)row,
+				      (uint32_t *)row + width - 1);
+		else
+			reverse_row16((uint16_t *)row,
+				      (uint16_t *)row + width - 1);
+	}
+
+	return 0;
+}
+
+int blit_flip_vertical(void *ptr, unsigned int pitch, unsigned int bpp,
+		       unsigned int x, unsigned int y,
+		       unsigned int width, unsigned int height)
+{
+	uint8_t tmp[SWAP_CHUNK];
+	uint8_t *top;
+	uint8_t *bottom;
+	size_t size;
+
+	if (!bpp || bpp % 8)
+		return -EINVAL;
+
+	if (height < 2)
+		return 0;
+
+	size = (size_t)width * (bpp / 8);
+	top = (uint8_t *)ptr + y * pitch + x * (bpp / 8);
+	bottom = top + (height - 1) * pitch;
+
+	/* swap whole rows, through a small buffer to avoid any allocation */
+	for (; top < bottom; top += pitch, bottom -= pitch) {
+		size_t offset, n;
+
+		for (offset = 0; offset < size; offset += n) {
+			n = size - offset < SWAP_CHUNK ? size - offset : SWAP_CHUNK;
+			memcpy(tmp, top + offset, n);
+			memcpy(top + offset, bottom + offset, n);
+			memcpy(bottom + offset, tmp, n);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Packed RGB formats, with the shift and size of the alpha, red, green and
+ * blue channels in the pixel. A size of 0 is for a missing channel.
+ */
+struct rgb_format {
+	uint32_t format;
+	uint8_t bpp;
+	uint8_t shift[4];
+	uint8_t bits[4];
+};
+
+static const struct rgb_format rgb_formats[] = {
+	{ DRM_FORMAT_ARGB8888, 32, { 24, 16,  8,  0 }, { 8, 8, 8, 8 } },
+	{ DRM_FORMAT_XRGB8888, 32, {  0, 16,  8,  0 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_RGB565,   16, {  0, 11,  5,  0 }, { 0, 5, 6, 5 } },
+	{ DRM_FORMAT_XBGR8888, 32, {  0,  0,  8, 16 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_ABGR8888, 32, { 24,  0,  8, 16 }, { 8, 8, 8, 8 } },
+	{ DRM_FORMAT_RGBX8888, 32, {  0, 24, 16,  8 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_RGBA8888, 32, {  0, 24, 16,  8 }, { 8, 8, 8, 8 } },
+	{ DRM_FORMAT_BGRX8888, 32, {  0,  8, 16, 24 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_BGRA8888, 32, {  0,  8, 16, 24 }, { 8, 8, 8, 8 } },
+	{ DRM_FORMAT_RGB888,   24, {  0, 16,  8,  0 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_BGR888,   24, {  0,  0,  8, 16 }, { 0, 8, 8, 8 } },
+	{ DRM_FORMAT_BGR565,   16, {  0,  0,  5, 11 }, { 0, 5, 6, 5 } },
+	{ DRM_FORMAT_ARGB4444, 16, { 12,  8,  4,  0 }, { 4, 4, 4, 4 } },
+	{ DRM_FORMAT_XRGB4444, 16, {  0,  8,  4,  0 }, { 0, 4, 4, 4 } },
+	{ DRM_FORMAT_ABGR4444, 16, { 12,  0,  4,  8 }, { 4, 4, 4, 4 } },
+	{ DRM_FORMAT_XBGR4444, 16, {  0,  0,  4,  8 }, { 0, 4, 4, 4 } },
+	{ DRM_FORMAT_RGBA4444, 16, {  0, 12,  8,  4 }, { 4, 4, 4, 4 } },
+	{ DRM_FORMAT_RGBX4444, 16, {  0, 12,  8,  4 }, { 0, 4, 4, 4 } },
+	{ DRM_FORMAT_BGRA4444, 16, {  0,  4,  8, 12 }, { 4, 4, 4, 4 } },
+	{ DRM_FORMAT_BGRX4444, 16, {  0,  4,  8, 12 }, { 0, 4, 4, 4 } },
+	{ DRM_FORMAT_ARGB1555, 16, { 15, 10,  5,  0 }, { 1, 5, 5, 5 } },
+	{ DRM_FORMAT_XRGB1555, 16, {  0, 10,  5,  0 }, { 0, 5, 5, 5 } },
+	{ DRM_FORMAT_ABGR1555, 16, { 15,  0,  5, 10 }, { 1, 5, 5, 5 } },
+	{ DRM_FORMAT_XBGR1555, 16, {  0,  0,  5, 10 }, { 0, 5, 5, 5 } },
+	{ DRM_FORMAT_RGBA5551, 16, {  0, 11,  6,  1 }, { 1, 5, 5, 5 } },
+	{ DRM_FORMAT_RGBX5551, 16, {  0, 11,  6,  1 }, { 0, 5, 5, 5 } },
+	{ DRM_FORMAT_BGRA5551, 16, {  0,  1,  6, 11 }, { 1, 5, 5, 5 } },
+	{ DRM_FORMAT_BGRX5551, 16, {  0,  1,  6, 11 }, { 0, 5, 5, 5 } },
+};
+
+enum yuv_layout {
+	YUV_PACKED,
+	YUV_SEMIPLANAR,
+	YUV_PLANAR,
+};
+
+/*
+ * YUV formats. For packed formats the offsets are the bytes of Y0, U, Y1 and
+ * V in a macropixel. For the others, swap tells the V plane or sample comes
+ * before the U one.
+ */
+struct yuv_format {
+	uint32_t format;
+	enum yuv_layout layout;
+	uint8_t hsub;
+	uint8_t vsub;
+	uint8_t offsets[4];
+	bool swap;
+};
+
+static const struct yuv_format yuv_formats[] = {
+	{ DRM_FORMAT_YUYV, YUV_PACKED, 2, 1, { 0, 1, 2, 3 }, false },
+	{ DRM_FORMAT_YVYU, YUV_PACKED, 2, 1, { 0, 3, 2, 1 }, false },
+	{ DRM_FORMAT_UYVY, YUV_PACKED, 2, 1, { 1, 0, 3, 2 }, false },
+	{ DRM_FORMAT_VYUY, YUV_PACKED, 2, 1, { 1, 2, 3, 0 }, false },
+	{ DRM_FORMAT_NV12, YUV_SEMIPLANAR, 2, 2, { 0 }, false },
+	{ DRM_FORMAT_NV21, YUV_SEMIPLANAR, 2, 2, { 0 }, true },
+	{ DRM_FORMAT_NV16, YUV_SEMIPLANAR, 2, 1, { 0 }, false },
+	{ DRM_FORMAT_NV61, YUV_SEMIPLANAR, 2, 1, { 0 }, true },
+	{ DRM_FORMAT_YUV420, YUV_PLANAR, 2, 2, { 0 }, false },
+	{ DRM_FORMAT_YVU420, YUV_PLANAR, 2, 2, { 0 }, true },
+	{ DRM_FORMAT_YUV422, YUV_PLANAR, 2, 1, { 0 }, false },
+	{ DRM_FORMAT_YVU422, YUV_PLANAR, 2, 1, { 0 }, true },
+	{ DRM_FORMAT_YUV444, YUV_PLANAR, 1, 1, { 0 }, false },
+	{ DRM_FORMAT_YVU444, YUV_PLANAR, 1, 1, { 0 }, true },
+};
+
+/* channel shifts of cairo ARGB32 pixels, in the order of struct rgb_format */
+static const uint8_t argb_shift[4] = { 24, 16, 8, 0 };
+
+static const struct rgb_format *rgb_format_get(uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(rgb_formats); i++)
+		if (rgb_formats[i].format == format)
+			return &rgb_formats[i];
+
+	return NULL;
+}
+
+static const struct yuv_format *yuv_format_get(uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(yuv_formats); i++)
+		if (yuv_formats[i].format == format)
+			return &yuv_formats[i];
+
+	return NULL;
+}
+
+bool blit_format_convertible(uint32_t format)
+{
+	return rgb_format_get(format) || yuv_format_get(format);
+}
+
+bool blit_format_is_yuv(uint32_t format)
+{
+	return yuv_format_get(format) != NULL;
+}
+
+static inline uint32_t pack_rgb_pixel(const struct rgb_format *fmt, uint32_t p)
+{
+	uint32_t v = 0;
+	unsigned int c;
+
+	for (c = 0; c < 4; c++)
+		if (fmt->bits[c])
+			v |= ((p >> (argb_shift[c] + 8 - fmt->bits[c])) &
+			      ((1u << fmt->bits[c]) - 1)) << fmt->shift[c];
+
+	return v;
+}
+
+static inline uint32_t unpack_rgb_pixel(const struct rgb_format *fmt, uint32_t v)
+{
+	uint32_t p = 0;
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		uint32_t mask = (1u << fmt->bits[c]) - 1;
+		uint32_t x = 0xff;
+
+		/* scale to 8 bits, missing alpha is opaque */
+		if (fmt->bits[c])
+			x = (((v >> fmt->shift[c]) & mask) * 255 + mask / 2) / mask;
+
+		p |= x << argb_shift[c];
+	}
+
+	return p;
+}
+
+/*
+ * Pack a row of 16 or 32 bpp pixels. Each channel is shifted down to its
+ * size, masked and shifted in place, four pixels at a time.
+ */
+static void pack_rgb_row(const struct rgb_format *fmt, uint8_t *dst,
+			 const uint32_t *src, unsigned int width)
+{
+	unsigned int i = 0;
+#if defined(__ARM_NEON)
+	int32x4_t rshift[4], lshift[4];
+	uint32x4_t mask[4];
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		rshift[c] = vdupq_n_s32(-(argb_shift[c] + 8 - fmt->bits[c]));
+		lshift[c] = vdupq_n_s32(fmt->shift[c]);
+		mask[c] = vdupq_n_u32(fmt->bits[c] ? (1u << fmt->bits[c]) - 1 : 0);
+	}
+
+	for (; fmt->bpp != 24 && i + 4 <= width; i += 4) {
+		uint32x4_t p = vld1q_u32(src + i);
+		uint32x4_t v = vdupq_n_u32(0);
+
+		for (c = 0; c < 4; c++)
+			v = vorrq_u32(v, vshlq_u32(vandq_u32(vshlq_u32(p, rshift[c]),
+							     mask[c]),
+						   lshift[c]));
+
+		if (fmt->bpp == 32)
+			vst1q_u32((uint32_t *)dst + i, v);
+		else
+			vst1_u16((uint16_t *)dst + i, vmovn_u32(v));
+	}
+#elif defined(__SSE2__)
+	__m128i rshift[4], lshift[4], mask[4];
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		rshift[c] = _mm_cvtsi32_si128(argb_shift[c] + 8 - fmt->bits[c]);
+		lshift[c] = _mm_cvtsi32_si128(fmt->shift[c]);
+		mask[c] = _mm_set1_epi32(fmt->bits[c] ? (1u << fmt->bits[c]) - 1 : 0);
+	}
+
+	for (; fmt->bpp != 24 && i + 4 <= width; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i v = _mm_setzero_si128();
+
+		for (c = 0; c < 4; c++)
+			v = _mm_or_si128(v, _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(p, rshift[c]),
+									mask[c]),
+							  lshift[c]));
+
+		if (fmt->bpp == 32) {
+			_mm_storeu_si128((__m128i *)((uint32_t *)dst + i), v);
+		} else {
+			/* sign extend so the saturating pack keeps the 16 bits */
+			v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+			_mm_storel_epi64((__m128i *)((uint16_t *)dst + i),
+					 _mm_packs_epi32(v, v));
+		}
+	}
+#endif
+	for (; i < width; i++) {
+		uint32_t v = pack_rgb_pixel(fmt, src[i]);
+
+		switch (fmt->bpp) {
+		case 16:
+			((uint16_t *)dst)[i] = v;
+			break;
+		case 24:
+			dst[i * 3] = v;
+			dst[i * 3 + 1] = v >> 8;
+			dst[i * 3 + 2] = v >> 16;
+			break;
+		default:
+			((uint32_t *)dst)[i] = v;
+			break;
+		}
+	}
+}
+
+static void unpack_rgb_row(const struct rgb_format *fmt, uint32_t *dst,
+			   const uint8_t *src, unsigned int width)
+{
+	unsigned int i;
+
+	for (i = 0; i < width; i++) {
+		uint32_t v;
+
+		switch (fmt->bpp) {
+		case 16:
+			v = ((const uint16_t *)src)[i];
+			break;
+		case 24:
+			v = src[i * 3] | src[i * 3 + 1] << 8 |
+				(uint32_t)src[i * 3 + 2] << 16;
+			break;
+		default:
+			v = ((const uint32_t *)src)[i];
+			break;
+		}
+
+		dst[i] = unpack_rgb_pixel(fmt, v);
+	}
+}
+
+/*
+ * Where the samples of a pixel or chroma block are, given the layout used by
+ * kms_framebuffer_create().
+ */
+struct yuv_planes {
+	uint8_t *y;
+	uint8_t *u;
+	uint8_t *v;
+	unsigned int y_pitch;
+	unsigned int c_pitch;
+	/* distance between two consecutive samples */
+	unsigned int y_step;
+	unsigned int c_step;
+};
+
+static void yuv_planes_get(const struct yuv_format *fmt,
+			   const struct blit_buffer *buf, struct yuv_planes *p)
+{
+	uint8_t *base = buf->ptr;
+	uint8_t *c0 = base + buf->pitch * buf->height;
+
+	p->y = base;
+	p->y_pitch = buf->pitch;
+	p->y_step = 1;
+	p->c_step = 1;
+
+	switch (fmt->layout) {
+	case YUV_PACKED:
+		p->y += fmt->offsets[0];
+		p->u = base + fmt->offsets[1];
+		p->v = base + fmt->offsets[3];
+		p->c_pitch = buf->pitch;
+		p->y_step = 2;
+		p->c_step = 4;
+		break;
+	case YUV_SEMIPLANAR:
+		p->u = c0 + fmt->swap;
+		p->v = c0 + !fmt->swap;
+		p->c_pitch = buf->pitch;
+		p->c_step = 2;
+		break;
+	case YUV_PLANAR:
+		p->c_pitch = buf->pitch / fmt->hsub;
+		p->u = c0;
+		p->v = c0 + p->c_pitch * (buf->height / fmt->vsub);
+		if (fmt->swap) {
+			uint8_t *t = p->u;
+
+			p->u = p->v;
+			p->v = t;
+		}
+		break;
+	}
+}
+
+static inline uint8_t clamp8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* BT.601 limited range */
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t rgb_to_u(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t rgb_to_v(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline uint32_t yuv_to_argb(int y, int u, int v)
+{
+	int c = 298 * (y - 16) + 128;
+	int d = u - 128;
+	int e = v - 128;
+
+	return 0xff000000 |
+		clamp8((c + 409 * e) >> 8) << 16 |
+		clamp8((c - 100 * d - 208 * e) >> 8) << 8 |
+		clamp8((c + 516 * d) >> 8);
+}
+
+/* y sample of pixel (x, y), for packed formats Y1 is 2 bytes after Y0 */
+static inline uint8_t *y_sample(const struct yuv_planes *p, unsigned int x,
+				unsigned int y)
+{
+	return p->y + y * p->y_pitch + x * p->y_step;
+}
+
+static void pack_yuv(const struct yuv_format *fmt, const struct blit_buffer *dst,
+		     const uint32_t *src, unsigned int stride,
+		     unsigned int x0, unsigned int y0,
+		     unsigned int x1, unsigned int y1)
+{
+	struct yuv_planes p;
+	unsigned int bx, by, x, y;
+
+	yuv_planes_get(fmt, dst, &p);
+
+	/* one chroma block at a time, the chroma being the average of the block */
+	for (by = y0; by < y1; by += fmt->vsub) {
+		for (bx = x0; bx < x1; bx += fmt->hsub) {
+			int r = 0, g = 0, b = 0, n = 0;
+			unsigned int c;
+
+			for (y = by; y < by + fmt->vsub && y < y1; y++) {
+				const uint32_t *row = src + y * stride;
+
+				for (x = bx; x < bx + fmt->hsub && x < x1; x++) {
+					uint32_t px = row[x];
+					int pr = (px >> 16) & 0xff;
+					int pg = (px >> 8) & 0xff;
+					int pb = px & 0xff;
+
+					*y_sample(&p, x, y) = rgb_to_y(pr, pg, pb);
+					r += pr;
+					g += pg;
+					b += pb;
+					n++;
+				}
+			}
+
+			r /= n;
+			g /= n;
+			b /= n;
+			c = (by / fmt->vsub) * p.c_pitch + (bx / fmt->hsub) * p.c_step;
+			p.u[c] = rgb_to_u(r, g, b);
+			p.v[c] = rgb_to_v(r, g, b);
+		}
+	}
+}
+
+static void unpack_yuv(const struct yuv_format *fmt,
+		       const struct blit_buffer *src, uint32_t *dst,
+		       unsigned int stride, unsigned int x0, unsigned int y0,
+		       unsigned int x1, unsigned int y1)
+{
+	struct yuv_planes p;
+	unsigned int x, y;
+
+	yuv_planes_get(fmt, src, &p);
+
+	for (y = y0; y < y1; y++) {
+		uint32_t *row = dst + y * stride;
+
+		for (x = x0; x < x1; x++) {
+			unsigned int c = (y / fmt->vsub) * p.c_pitch +
+				(x / fmt->hsub) * p.c_step;
+
+			row[x] = yuv_to_argb(*y_sample(&p, x, y), p.u[c], p.v[c]);
+		}
+	}
+}
+
+/*
+ * Clip the rectangle to the buffer and grow it to whole chroma blocks.
+ * @return false if nothing is left.
+ */
+static bool convert_rect(const struct blit_buffer *buf,
+			 const struct yuv_format *yuv,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height,
+			 unsigned int *x0, unsigned int *y0,
+			 unsigned int *x1, unsigned int *y1)
+{
+	*x0 = x;
+	*y0 = y;
+	*x1 = x + width < buf->width ? x + width : buf->width;
+	*y1 = y + height < buf->height ? y + height : buf->height;
+
+	if (yuv) {
+		*x0 -= *x0 % yuv->hsub;
+		*y0 -= *y0 % yuv->vsub;
+		*x1 += (yuv->hsub - *x1 % yuv->hsub) % yuv->hsub;
+		*y1 += (yuv->vsub - *y1 % yuv->vsub) % yuv->vsub;
+		if (*x1 > buf->width)
+			*x1 = buf->width;
+		if (*y1 > buf->height)
+			*y1 = buf->height;
+	}
+
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+int blit_pack(const struct blit_buffer *dst, const uint32_t *src,
+	      unsigned int stride, unsigned int x, unsigned int y,
+	      unsigned int width, unsigned int height)
+{
+	const struct rgb_format *rgb = rgb_format_get(dst->format);
+	const struct yuv_format *yuv = yuv_format_get(dst->format);
+	unsigned int x0, y0, x1, y1;
+
+	if (!rgb && !yuv)
+		return -EINVAL;
+
+	/* stride is in bytes, like cairo's */
+	stride /= 4;
+
+	if (!convert_rect(dst, yuv, x, y, width, height, &x0, &y0, &x1, &y1))
+		return 0;
+
+	if (yuv) {
+		pack_yuv(yuv, dst, src, stride, x0, y0, x1, y1);
+		return 0;
+	}
+
+	for (y = y0; y < y1; y++)
+		pack_rgb_row(rgb, (uint8_t *)dst->ptr + y * dst->pitch +
+			     x0 * (rgb->bpp / 8),
+			     src + y * stride + x0, x1 - x0);
+
+	return 0;
+}
+
+int blit_unpack(const struct blit_buffer *src, uint32_t *dst,
+		unsigned int stride, unsigned int x, unsigned int y,
+		unsigned int width, unsigned int height)
+{
+	const struct rgb_format *rgb = rgb_format_get(src->format);
+	const struct yuv_format *yuv = yuv_format_get(src->format);
+	unsigned int x0, y0, x1, y1;
+
+	if (!rgb && !yuv)
+		return -EINVAL;
+
+	stride /= 4;
+
+	if (!convert_rect(src, yuv, x, y, width, height, &x0, &y0, &x1, &y1))
+		return 0;
+
+	if (yuv) {
+		unpack_yuv(yuv, src, dst, stride, x0, y0, x1, y1);
+		return 0;
+	}
+
+	for (y = y0; y < y1; y++)
+		unpack_rgb_row(rgb, dst + y * stride + x0,
+			       (const uint8_t *)src->ptr + y * src->pitch +
+			       x0 * (rgb->bpp / 8), x1 - x0);
+
+	return 0;
+}
+
+/*
+ * Fill a row with a pixel value, with vector stores of the value repeated
+ * over 16 bytes.
+ */
+static void fill_row(uint8_t *dst, unsigned int bpp, uint32_t v,
+		     unsigned int width)
+{
+	unsigned int i = 0;
+
+	if (bpp == 16)
+		v = (v & 0xffff) | v << 16;
+
+	if (bpp != 24) {
+		unsigned int n = width * (bpp / 8);
+		unsigned int bytes = 0;
+#if defined(__ARM_NEON)
+		uint32x4_t q = vdupq_n_u32(v);
+
+		for (; bytes + 16 <= n; bytes += 16)
+			vst1q_u32((uint32_t *)(dst + bytes), q);
+#elif defined(__SSE2__)
+		__m128i q = _mm_set1_epi32(v);
+
+		for (; bytes + 16 <= n; bytes += 16)
+			_mm_storeu_si128((__m128i *)(dst + bytes), q);
+#endif
+		/* 16 bpp rows may not be aligned on 4 bytes */
+		for (; bytes + 4 <= n; bytes += 4)
+			memcpy(dst + bytes, &v, 4);
+		if (bytes < n)
+			memcpy(dst + bytes, &v, 2);
+		return;
+	}
+
+	for (; i < width; i++) {
+		dst[i * 3] = v;
+		dst[i * 3 + 1] = v >> 8;
+		dst[i * 3 + 2] = v >> 16;
+	}
+}
+
+int blit_fill(const struct blit_buffer *buf, uint32_t argb,
+	      unsigned int x, unsigned int y,
+	      unsigned int width, unsigned int height)
+{
+	const struct rgb_format *fmt = rgb_format_get(buf->format);
+	uint8_t *row;
+	uint32_t v;
+	unsigned int i;
+
+	if (!fmt)
+		return -EINVAL;
+
+	if (x >= buf->width || y >= buf->height)
+		return 0;
+	if (width > buf->width - x)
+		width = buf->width - x;
+	if (height > buf->height - y)
+		height = buf->height - y;
+
+	v = pack_rgb_pixel(fmt, argb);
+	row = (uint8_t *)buf->ptr + y * buf->pitch + x * (fmt->bpp / 8);
+
+	for (i = 0; i < height; i++, row += buf->pitch)
+		fill_row(row, fmt->bpp, v, width);
+
+	return 0;
+}
+
+int blit_fill_checker(const struct blit_buffer *buf, const uint32_t argb[2],
+		      unsigned int size)
+{
+	const struct rgb_format *fmt = rgb_format_get(buf->format);
+	unsigned int cpp, x, y;
+	uint32_t v[2];
+	uint8_t *base;
+
+	if (!fmt || !size)
+		return -EINVAL;
+
+	if (argb[0] == argb[1])
+		return blit_fill(buf, argb[0], 0, 0, buf->width, buf->height);
+
+	cpp = fmt->bpp / 8;
+	base = buf->ptr;
+	v[0] = pack_rgb_pixel(fmt, argb[0]);
+	v[1] = pack_rgb_pixel(fmt, argb[1]);
+
+	/*
+	 * Only the first row of each band of squares is drawn, the other rows of
+	 * the band are copies of it.
+	 */
+	for (y = 0; y < buf->height; y++) {
+		uint8_t *row = base + y * buf->pitch;
+
+		if (y % size) {
+			memcpy(row, row - buf->pitch, buf->width * cpp);
+			continue;
+		}
+
+		for (x = 0; x < buf->width; x += size) {
+			unsigned int n = buf->width - x < size ?
+				buf->width - x : size;
+
+			fill_row(row + x * cpp, fmt->bpp,
+				 v[((x / size) ^ (y / size)) & 1], n);
+		}
+	}
+
+	return 0;
+}
+
+/* x / 255 for x up to 255 * 255, rounded */
+static inline uint32_t div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * Blend one pixel: OVER of the premultiplied color, scaled by the coverage m.
+ */
+static inline uint32_t blend_pixel(uint32_t s, uint32_t d, uint32_t m)
+{
+	uint32_t inv = 255 - div255((s >> 24) * m);
+	uint32_t v = 0;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8)
+		v |= div255(((s >> shift) & 0xff) * m +
+			    ((d >> shift) & 0xff) * inv) << shift;
+
+	return v;
+}
+
+/*
+ * Blend a row of cairo layout 32 bpp pixels. The channels are blended in 16 bit
+ * lanes, two pixels per vector on NEON and four on SSE2.
+ */
+static void blend_row32(uint32_t *dst, const uint8_t *mask, uint32_t s,
+			unsigned int width)
+{
+	unsigned int i = 0;
+#if defined(__ARM_NEON)
+	uint8x8_t src = vreinterpret_u8_u32(vdup_n_u32(s));
+	uint8x8_t sa = vdup_n_u8(s >> 24);
+
+	for (; i + 2 <= width; i += 2) {
+		uint8x8_t m, inv, d;
+		uint16x8_t t;
+
+		if (!(mask[i] | mask[i + 1]))
+			continue;
+
+		m = vreinterpret_u8_u32(vset_lane_u32(mask[i + 1] * 0x01010101u,
+						      vdup_n_u32(mask[i] * 0x01010101u), 1));
+		t = vmull_u8(sa, m);
+		inv = vmvn_u8(vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+		d = vld1_u8((const uint8_t *)(dst + i));
+		t = vmlal_u8(vmull_u8(src, m), d, inv);
+		vst1_u8((uint8_t *)(dst + i), vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32(s), zero);
+	const __m128i sa = _mm_set1_epi16(s >> 24);
+
+	for (; i + 4 <= width; i += 4) {
+		__m128i d, dl, dh, ml, mh, m;
+		uint32_t m4;
+
+		memcpy(&m4, mask + i, 4);
+		if (!m4)
+			continue;
+
+		/* coverage of each pixel repeated over its four channels */
+		m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), zero);
+		m = _mm_unpacklo_epi16(m, m);
+		ml = _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 1, 0, 0));
+		mh = _mm_shuffle_epi32(m, _MM_SHUFFLE(3, 3, 2, 2));
+
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		dl = _mm_unpacklo_epi8(d, zero);
+		dh = _mm_unpackhi_epi8(d, zero);
+
+#define BLEND_HALF(dx, mx)						\
+	do {								\
+		__m128i t = _mm_add_epi16(_mm_mullo_epi16(sa, mx), c128); \
+		__m128i inv = _mm_sub_epi16(c255,			\
+			_mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8)); \
+		t = _mm_add_epi16(_mm_mullo_epi16(src, mx),		\
+				  _mm_mullo_epi16(dx, inv));		\
+		t = _mm_add_epi16(t, c128);				\
+		dx = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8); \
+	} while (0)
+
+		BLEND_HALF(dl, ml);
+		BLEND_HALF(dh, mh);
+#undef BLEND_HALF
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(dl, dh));
+	}
+#endif
+	for (; i < width; i++)
+		if (mask[i])
+			dst[i] = blend_pixel(s, dst[i], mask[i]);
+}
+
+int blit_blend_mask(const struct blit_buffer *dst, int x, int y,
+		    const uint8_t *mask, unsigned int stride,
+		    unsigned int width, unsigned int height, uint32_t argb)
+{
+	const struct rgb_format *fmt = rgb_format_get(dst->format);
+	unsigned int cpp, i, j;
+	uint8_t *row;
+
+	if (!fmt)
+		return -EINVAL;
+
+	/* clip, moving into the mask along */
+	if (x < 0) {
+		if ((unsigned int)-x >= width)
+			return 0;
+		mask -= x;
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		if ((unsigned int)-y >= height)
+			return 0;
+		mask -= y * (int)stride;
+		height += y;
+		y = 0;
+	}
+	if ((unsigned int)x >= dst->width || (unsigned int)y >= dst->height)
+		return 0;
+	if (width > dst->width - x)
+		width = dst->width - x;
+	if (height > dst->height - y)
+		height = dst->height - y;
+
+	cpp = fmt->bpp / 8;
+	row = (uint8_t *)dst->ptr + y * dst->pitch + x * cpp;
+
+	for (j = 0; j < height; j++, row += dst->pitch, mask += stride) {
+		/* cairo's own layout can be blended in place */
+		if (dst->format == DRM_FORMAT_ARGB8888 ||
+		    dst->format == DRM_FORMAT_XRGB8888) {
+			blend_row32((uint32_t *)row, mask, argb, width);
+			continue;
+		}
+
+		for (i = 0; i < width; i++) {
+			uint8_t *p = row + i * cpp;
+			uint32_t v = 0;
+
+			if (!mask[i])
+				continue;
+
+			memcpy(&v, p, cpp);
+			v = pack_rgb_pixel(fmt, blend_pixel(argb,
+							    unpack_rgb_pixel(fmt, v),
+							    mask[i]));
+			memcpy(p, &v, cpp);
+		}
+	}
+
+	return 0;
+}
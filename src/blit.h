@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 Microchip Technology Inc.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef PLANES_BLIT_H
+#define PLANES_BLIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A mapped framebuffer. Planes of multi-planar formats follow the first one,
+ * laid out as kms_framebuffer_create() does.
+ */
+struct blit_buffer {
+	void *ptr;
+	unsigned int pitch;
+	unsigned int width;
+	unsigned int height;
+	uint32_t format;
+};
+
+/*
+ * Pixel kernels working directly on mapped framebuffer memory. The rectangle
+ * must be inside the buffer. They return -EINVAL when the pixel size isn't
+ * supported, so callers can fall back to cairo.
+ */
+int blit_flip_horizontal(void *ptr, unsigned int pitch, unsigned int bpp,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height);
+int blit_flip_vertical(void *ptr, unsigned int pitch, unsigned int bpp,
+		       unsigned int x, unsigned int y,
+		       unsigned int width, unsigned int height);
+
+/*
+ * Conversion between the native format of a buffer and cairo ARGB32 pixels,
+ * for formats cairo can't draw into. Only the given rectangle is converted,
+ * grown to whole chroma blocks for subsampled YUV formats. Return -EINVAL
+ * for formats without a conversion.
+ */
+bool blit_format_convertible(uint32_t format);
+bool blit_format_is_yuv(uint32_t format);
+int blit_pack(const struct blit_buffer *dst, const uint32_t *src,
+	      unsigned int stride, unsigned int x, unsigned int y,
+	      unsigned int width, unsigned int height);
+int blit_unpack(const struct blit_buffer *src, uint32_t *dst,
+		unsigned int stride, unsigned int x, unsigned int y,
+		unsigned int width, unsigned int height);
+
+/*
+ * Fills in packed RGB formats, with colors given as cairo ARGB32 pixels.
+ * The checker is made of squares of the given size, starting with the first
+ * color in the top left corner.
+ */
+int blit_fill(const struct blit_buffer *buf, uint32_t argb,
+	      unsigned int x, unsigned int y,
+	      unsigned int width, unsigned int height);
+int blit_fill_checker(const struct blit_buffer *buf, const uint32_t argb[2],
+		      unsigned int size);
+
+/*
+ * Blend a premultiplied ARGB32 color in a packed RGB buffer through an 8 bit
+ * coverage mask, like cairo's OVER operator. The mask is clipped to the buffer.
+ */
+int blit_blend_mask(const struct blit_buffer *dst, int x, int y,
+		    const uint8_t *mask, unsigned int stride,
+		    unsigned int width, unsigned int height, uint32_t argb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,7 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include "blit.h"
 #include "common.h"
 #include "p_kms.h"
 #include "planes/draw.h"
@@ -28,8 +29,10 @@
 #include <cairo.h>
 #include <drm_fourcc.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
@@ -48,40 +51,629 @@ static cairo_format_t drm2cairo(uint32_t format)
 	return CAIRO_FORMAT_INVALID;
 }
 
-int render_fb_text(struct kms_framebuffer* fb, int x, int y, const char* text,
-		   uint32_t color, float size)
+/*
+ * Cairo surface and context drawing into a framebuffer. They are created on
+ * first use and kept with the framebuffer as long as it stays mapped, so
+ * successive draw calls don't set them up again.
+ *
+ * Formats cairo can't draw into are drawn in an ARGB32 scratch surface. The
+ * rectangles drawn to are converted to the native format when the context is
+ * given back.
+ */
+struct fb_cairo {
+	cairo_surface_t* surface;
+	cairo_t* cr;
+	/* drawing in a scratch surface converted to the framebuffer format */
+	bool convert;
+	/* the framebuffer was changed without going through the scratch surface */
+	bool stale;
+};
+
+static void fb_cairo_free(void* data)
+{
+	struct fb_cairo* c = data;
+
+	cairo_destroy(c->cr);
+	cairo_surface_destroy(c->surface);
+	free(c);
+}
+
+/*
+ * Describe the mapped framebuffer for the blit kernels.
+ */
+static void fb_to_blit(struct kms_framebuffer* fb, struct blit_buffer* buf)
+{
+	buf->ptr = fb->ptr;
+	buf->pitch = fb->pitch;
+	buf->width = fb->width;
+	buf->height = fb->height;
+	buf->format = fb->format;
+}
+
+/*
+ * Convert the whole framebuffer into the scratch surface.
+ */
+static void fb_cairo_load(struct kms_framebuffer* fb, struct fb_cairo* c)
+{
+	struct blit_buffer buf;
+
+	fb_to_blit(fb, &buf);
+
+	cairo_surface_flush(c->surface);
+	blit_unpack(&buf, (uint32_t*)cairo_image_surface_get_data(c->surface),
+		    cairo_image_surface_get_stride(c->surface),
+		    0, 0, fb->width, fb->height);
+	cairo_surface_mark_dirty(c->surface);
+
+	c->stale = false;
+}
+
+/*
+ * Tell the draw cache the framebuffer pixels were changed directly.
+ */
+static void fb_cairo_invalidate(struct kms_framebuffer* fb)
 {
+	struct fb_cairo* c = fb->draw_data;
+
+	if (c)
+		c->stale = true;
+}
+
+/*
+ * Map the framebuffer and get its cairo context with the state saved. It must
+ * be given back with fb_cairo_put().
+ */
+static cairo_t* fb_cairo_get(struct kms_framebuffer* fb)
+{
+	struct fb_cairo* c;
+	cairo_format_t cairo_format;
 	void* ptr;
 	int err;
-	cairo_t* cr;
-	cairo_surface_t* surface;
-	struct rgba_color rgba;
-	cairo_format_t cairo_format = drm2cairo(fb->format);
 
 	err = kms_framebuffer_map(fb, &ptr);
 	if (err < 0) {
 		LOG("error: kms_framebuffer_map() failed: %s\n",
 		    strerror(-err));
-		return -1;
+		return NULL;
 	}
 
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
+	c = fb->draw_data;
+	if (c) {
+		/* the pixels may have been changed behind cairo's back */
+		if (!c->convert)
+			cairo_surface_mark_dirty(c->surface);
+		else if (c->stale)
+			fb_cairo_load(fb, c);
+		cairo_save(c->cr);
+		return c->cr;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		kms_framebuffer_unmap(fb);
+		return NULL;
+	}
+
+	cairo_format = drm2cairo(fb->format);
+	if (cairo_format == CAIRO_FORMAT_INVALID &&
+	    blit_format_convertible(fb->format)) {
+		c->convert = true;
+		c->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+							fb->width, fb->height);
+	} else {
+		c->surface = cairo_image_surface_create_for_data(ptr,
+								 cairo_format,
+								 fb->width, fb->height,
+								 cairo_format_stride_for_width(cairo_format, fb->width));
+	}
+	c->cr = cairo_create(c->surface);
+	if (cairo_status(c->cr)) {
+		LOG("error: can't draw in fb 0x%x: %s\n", fb->id,
+		    cairo_status_to_string(cairo_status(c->cr)));
+		fb_cairo_free(c);
+		kms_framebuffer_unmap(fb);
+		return NULL;
+	}
+
+	fb->draw_data = c;
+	fb->draw_free = fb_cairo_free;
+
+	if (c->convert)
+		fb_cairo_load(fb, c);
+
+	cairo_save(c->cr);
+
+	return c->cr;
+}
+
+/*
+ * Give back the context after drawing in the given rectangle.
+ */
+static void fb_cairo_put_rect(struct kms_framebuffer* fb, cairo_t* cr,
+			      int x, int y, int width, int height)
+{
+	struct fb_cairo* c = fb->draw_data;
+	struct blit_buffer buf;
+
+	cairo_restore(cr);
+	cairo_surface_flush(c->surface);
+
+	kms_framebuffer_damage(fb, x, y, width, height);
+
+	if (c->convert) {
+		x = MAX(x, 0);
+		y = MAX(y, 0);
+		width = MIN(x + width, (int)fb->width) - x;
+		height = MIN(y + height, (int)fb->height) - y;
+
+		if (width > 0 && height > 0) {
+			fb_to_blit(fb, &buf);
+			blit_pack(&buf,
+				  (const uint32_t*)cairo_image_surface_get_data(c->surface),
+				  cairo_image_surface_get_stride(c->surface),
+				  x, y, width, height);
+		}
+	}
+
+	kms_framebuffer_unmap(fb);
+}
+
+static void fb_cairo_put(struct kms_framebuffer* fb, cairo_t* cr)
+{
+	fb_cairo_put_rect(fb, cr, 0, 0, fb->width, fb->height);
+}
+
+#define FONT_CACHE_SIZE 8
+#define TEXT_CACHE_SIZE 64
+
+/*
+ * Text is drawn with one font face, resolved once. Scaled fonts are kept per
+ * size, and strings are kept laid out as glyphs at the origin, so drawing a
+ * string again is a lookup and a cairo_show_glyphs().
+ */
+struct font_entry {
+	double size;
+	cairo_scaled_font_t* font;
+};
+
+struct text_entry {
+	cairo_scaled_font_t* font;
+	char* str;
+	cairo_glyph_t* glyphs;
+	int num_glyphs;
+	cairo_text_extents_t extents;
+};
+
+static cairo_font_face_t* text_face;
+static struct font_entry font_cache[FONT_CACHE_SIZE];
+static unsigned int font_next;
+static struct text_entry text_cache[TEXT_CACHE_SIZE];
+
+static void text_entry_free(struct text_entry* t)
+{
+	cairo_glyph_free(t->glyphs);
+	free(t->str);
+	memset(t, 0, sizeof(*t));
+}
+
+static cairo_font_face_t* text_face_get(void)
+{
+	if (!text_face)
+		text_face = cairo_toy_font_face_create("Serif",
+						       CAIRO_FONT_SLANT_NORMAL,
+						       CAIRO_FONT_WEIGHT_NORMAL);
+
+	return text_face;
+}
+
+static cairo_scaled_font_t* font_cache_get(cairo_t* cr, double size)
+{
+	struct font_entry* f;
+	unsigned int i;
+
+	for (i = 0; i < FONT_CACHE_SIZE; i++)
+		if (font_cache[i].font && font_cache[i].size == size)
+			return font_cache[i].font;
+
+	f = &font_cache[font_next];
+	font_next = (font_next + 1) % FONT_CACHE_SIZE;
+
+	if (f->font) {
+		/* strings laid out with the evicted font go with it */
+		for (i = 0; i < TEXT_CACHE_SIZE; i++)
+			if (text_cache[i].font == f->font)
+				text_entry_free(&text_cache[i]);
+		cairo_scaled_font_destroy(f->font);
+	}
+
+	/* same font options as the surface, like cairo_show_text() would use */
+	cairo_set_font_face(cr, text_face_get());
+	cairo_set_font_size(cr, size);
+	f->font = cairo_scaled_font_reference(cairo_get_scaled_font(cr));
+	f->size = size;
+
+	return f->font;
+}
+
+static uint32_t text_hash(const char* str, const void* font)
+{
+	uint32_t h = 2166136261u ^ (uint32_t)(uintptr_t)font;
+
+	while (*str)
+		h = (h ^ (uint8_t)*str++) * 16777619u;
+
+	return h;
+}
+
+static struct text_entry* text_cache_get(cairo_scaled_font_t* font,
+					 const char* str)
+{
+	struct text_entry* t = &text_cache[text_hash(str, font) % TEXT_CACHE_SIZE];
+	cairo_status_t status;
+
+	if (t->font == font && t->str && !strcmp(t->str, str))
+		return t;
+
+	text_entry_free(t);
+
+	status = cairo_scaled_font_text_to_glyphs(font, 0, 0, str, -1,
+						  &t->glyphs, &t->num_glyphs,
+						  NULL, NULL, NULL);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		LOG("error: can't lay out text: %s\n",
+		    cairo_status_to_string(status));
+		return NULL;
+	}
+
+	t->str = strdup(str);
+	if (!t->str) {
+		text_entry_free(t);
+		return NULL;
+	}
+
+	t->font = font;
+	cairo_scaled_font_glyph_extents(font, t->glyphs, t->num_glyphs,
+					&t->extents);
+
+	return t;
+}
+
+/*
+ * Draw text with cairo. If box isn't NULL, it gets the area drawn to.
+ */
+static int render_fb_text_box(struct kms_framebuffer* fb, int x, int y,
+			      const char* text, uint32_t color, float size,
+			      struct drm_mode_rect* box)
+{
+	cairo_t* cr;
+	struct rgba_color rgba;
+	cairo_scaled_font_t* font;
+	struct text_entry* t;
+	struct drm_mode_rect r;
+
+	cr = fb_cairo_get(fb);
+	if (!cr)
+		return -1;
+
+	font = font_cache_get(cr, size);
+	t = text_cache_get(font, text);
+	if (!t) {
+		fb_cairo_put_rect(fb, cr, 0, 0, 0, 0);
+		return -1;
+	}
 
 	parse_color(color, &rgba);
 	cairo_set_source_rgba(cr, rgba.r, rgba.g, rgba.b, rgba.a);
-	cairo_select_font_face(cr, "Serif", CAIRO_FONT_SLANT_NORMAL,
-			       CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, size);
-	cairo_move_to(cr, x, y);
-	cairo_show_text(cr, text);
-	cairo_stroke(cr);
+	cairo_set_scaled_font(cr, font);
+	cairo_translate(cr, x, y);
+	cairo_show_glyphs(cr, t->glyphs, t->num_glyphs);
+
+	/* with a pixel of margin for antialiasing */
+	r.x1 = x + t->extents.x_bearing - 1;
+	r.y1 = y + t->extents.y_bearing - 1;
+	r.x2 = r.x1 + (int)(t->extents.width + 3);
+	r.y2 = r.y1 + (int)(t->extents.height + 3);
+	fb_cairo_put_rect(fb, cr, r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+
+	if (box)
+		*box = r;
+
+	return 0;
+}
+
+int render_fb_text(struct kms_framebuffer* fb, int x, int y, const char* text,
+		   uint32_t color, float size)
+{
+	return render_fb_text_box(fb, x, y, text, color, size, NULL);
+}
+
+/*
+ * Opaque RGBA color, as used by the draw API, to a cairo ARGB32 pixel.
+ */
+static uint32_t rgba_to_argb(uint32_t color)
+{
+	return 0xff000000 | color >> 8;
+}
+
+static uint32_t lerp_argb(uint32_t a, uint32_t b, double t)
+{
+	uint32_t v = 0xff000000;
+	int shift;
 
+	for (shift = 0; shift < 24; shift += 8) {
+		int ca = (a >> shift) & 0xff;
+		int cb = (b >> shift) & 0xff;
+
+		v |= (uint32_t)(ca + (cb - ca) * t + 0.5) << shift;
+	}
+
+	return v;
+}
+
+/*
+ * Map the framebuffer for the native fill kernels.
+ * @return false if they don't support the format, cairo has to be used then.
+ */
+static bool fb_fill_begin(struct kms_framebuffer* fb, struct blit_buffer* buf)
+{
+	void* ptr;
+
+	if (blit_format_is_yuv(fb->format) || !blit_format_convertible(fb->format))
+		return false;
+
+	if (kms_framebuffer_map(fb, &ptr) < 0)
+		return false;
+
+	fb_to_blit(fb, buf);
+
+	return true;
+}
+
+static void fb_fill_end(struct kms_framebuffer* fb)
+{
+	kms_framebuffer_damage(fb, 0, 0, fb->width, fb->height);
+	fb_cairo_invalidate(fb);
+	kms_framebuffer_unmap(fb);
+}
+
+#define ATLAS_FIRST ' '
+#define ATLAS_LAST '~'
+
+struct text_glyph {
+	/* column of the glyph in the atlas */
+	int column;
+	int bearing_x;
+	int bearing_y;
+	int width;
+	int height;
+	int advance;
+};
+
+/*
+ * The printable ASCII glyphs of a font, rasterised side by side in an A8
+ * surface.
+ */
+struct text_atlas {
+	cairo_surface_t* surface;
+	float size;
+	struct text_glyph glyphs[ATLAS_LAST - ATLAS_FIRST + 1];
+};
+
+/* without pulling libm in for floor() and ceil() */
+static int ifloor(double v)
+{
+	int i = (int)v;
+
+	return i > v ? i - 1 : i;
+}
+
+static int iceil(double v)
+{
+	int i = (int)v;
+
+	return i < v ? i + 1 : i;
+}
+
+struct text_atlas* text_atlas_create(float size)
+{
+	struct text_atlas* atlas;
+	cairo_surface_t* surface;
+	cairo_scaled_font_t* font;
+	cairo_glyph_t glyphs[ATLAS_LAST - ATLAS_FIRST + 1];
+	cairo_t* cr;
+	int width = 0, height = 1;
+	int c;
+
+	atlas = calloc(1, sizeof(*atlas));
+	if (!atlas)
+		return NULL;
+
+	atlas->size = size;
+
+	/* a throwaway context gives the scaled font cairo_show_text() would use */
+	surface = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+	cr = cairo_create(surface);
+	cairo_set_font_face(cr, text_face_get());
+	cairo_set_font_size(cr, size);
+	font = cairo_scaled_font_reference(cairo_get_scaled_font(cr));
+	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
+
+	for (c = ATLAS_FIRST; c <= ATLAS_LAST; c++) {
+		struct text_glyph* g = &atlas->glyphs[c - ATLAS_FIRST];
+		char str[2] = { c, 0 };
+		cairo_glyph_t* glyph = &glyphs[c - ATLAS_FIRST];
+		cairo_glyph_t* out = glyph;
+		cairo_text_extents_t extents;
+		int num = 1;
+
+		if (cairo_scaled_font_text_to_glyphs(font, 0, 0, str, 1, &out,
+						     &num, NULL, NULL, NULL) ||
+		    num != 1) {
+			LOG("error: no glyph for '%c'\n", c);
+			glyph->index = 0;
+		} else if (out != glyph) {
+			*glyph = out[0];
+		}
+		if (out != glyph)
+			cairo_glyph_free(out);
+
+		glyph->x = glyph->y = 0;
+		cairo_scaled_font_glyph_extents(font, glyph, 1, &extents);
+
+		g->bearing_x = ifloor(extents.x_bearing);
+		g->bearing_y = ifloor(extents.y_bearing);
+		g->width = iceil(extents.x_bearing + extents.width) - g->bearing_x;
+		g->height = iceil(extents.y_bearing + extents.height) - g->bearing_y;
+		g->advance = ifloor(extents.x_advance + 0.5);
+		g->column = width;
+
+		/* a column of space between glyphs keeps them from bleeding */
+		width += g->width + 1;
+		height = MAX(height, g->height);
+	}
+
+	atlas->surface = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+	cr = cairo_create(atlas->surface);
+	cairo_set_scaled_font(cr, font);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+
+	for (c = 0; c <= ATLAS_LAST - ATLAS_FIRST; c++) {
+		glyphs[c].x = atlas->glyphs[c].column - atlas->glyphs[c].bearing_x;
+		glyphs[c].y = -atlas->glyphs[c].bearing_y;
+	}
+	cairo_show_glyphs(cr, glyphs, ATLAS_LAST - ATLAS_FIRST + 1);
+
 	cairo_destroy(cr);
+	cairo_scaled_font_destroy(font);
+	cairo_surface_flush(atlas->surface);
+
+	if (cairo_surface_status(atlas->surface)) {
+		LOG("error: can't create text atlas: %s\n",
+		    cairo_status_to_string(cairo_surface_status(atlas->surface)));
+		text_atlas_free(atlas);
+		return NULL;
+	}
+
+	return atlas;
+}
+
+void text_atlas_free(struct text_atlas* atlas)
+{
+	if (atlas) {
+		cairo_surface_destroy(atlas->surface);
+		free(atlas);
+	}
+}
+
+/*
+ * RGBA color, as used by the draw API, to a premultiplied cairo ARGB32 pixel.
+ */
+static uint32_t rgba_to_premultiplied(uint32_t color)
+{
+	uint32_t a = color & 0xff;
+	uint32_t v = a << 24;
+	int shift;
+
+	for (shift = 8; shift < 32; shift += 8)
+		v |= (((color >> shift) & 0xff) * a + 127) / 255 << (shift - 8);
+
+	return v;
+}
+
+/*
+ * Fallback for formats the blend kernel doesn't handle.
+ */
+static int render_fb_text_atlas_cairo(struct kms_framebuffer* fb,
+				      struct text_atlas* atlas, int x, int y,
+				      const char* text, uint32_t color,
+				      uint32_t background,
+				      struct drm_mode_rect* box)
+{
+	struct rgba_color rgba;
+	cairo_t* cr;
+
+	if (box && box->x2 > box->x1 && box->y2 > box->y1) {
+		cr = fb_cairo_get(fb);
+		if (!cr)
+			return -1;
+
+		parse_color(background, &rgba);
+		cairo_set_source_rgba(cr, rgba.r, rgba.g, rgba.b, rgba.a);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_rectangle(cr, box->x1, box->y1, box->x2 - box->x1,
+				box->y2 - box->y1);
+		cairo_fill(cr);
+
+		fb_cairo_put_rect(fb, cr, box->x1, box->y1, box->x2 - box->x1,
+				  box->y2 - box->y1);
+	}
+
+	/* cairo lays the text out on its own, the atlas metrics don't apply */
+	return render_fb_text_box(fb, x, y, text, color, atlas->size, box);
+}
+
+int render_fb_text_atlas(struct kms_framebuffer* fb, struct text_atlas* atlas,
+			 int x, int y, const char* text, uint32_t color,
+			 uint32_t background, struct drm_mode_rect* box)
+{
+	struct blit_buffer buf;
+	struct drm_mode_rect bounds = { x, y, x, y };
+	const uint8_t* data;
+	unsigned int stride;
+	uint32_t argb;
+	const char* s;
+	int pen = x;
+
+	if (!atlas)
+		return -1;
+
+	if (blit_format_is_yuv(fb->format) || !fb_fill_begin(fb, &buf))
+		return render_fb_text_atlas_cairo(fb, atlas, x, y, text, color,
+						  background, box);
+
+	/* only the previous text is cleared, not the whole line */
+	if (box) {
+		int x1 = MAX(box->x1, 0);
+		int y1 = MAX(box->y1, 0);
+
+		if (box->x2 > x1 && box->y2 > y1) {
+			blit_fill(&buf, rgba_to_premultiplied(background),
+				  x1, y1, box->x2 - x1, box->y2 - y1);
+			kms_framebuffer_damage(fb, x1, y1, box->x2 - x1,
+					       box->y2 - y1);
+		}
+	}
+
+	argb = rgba_to_premultiplied(color);
+	data = cairo_image_surface_get_data(atlas->surface);
+	stride = cairo_image_surface_get_stride(atlas->surface);
+
+	for (s = text; *s; s++) {
+		struct text_glyph* g;
+
+		if (*s < ATLAS_FIRST || *s > ATLAS_LAST)
+			continue;
+
+		g = &atlas->glyphs[*s - ATLAS_FIRST];
+		blit_blend_mask(&buf, pen + g->bearing_x, y + g->bearing_y,
+				data + g->column, stride, g->width, g->height,
+				argb);
+
+		bounds.x1 = MIN(bounds.x1, pen + g->bearing_x);
+		bounds.y1 = MIN(bounds.y1, y + g->bearing_y);
+		bounds.x2 = MAX(bounds.x2, pen + g->bearing_x + g->width);
+		bounds.y2 = MAX(bounds.y2, y + g->bearing_y + g->height);
+		pen += g->advance;
+	}
+
+	kms_framebuffer_damage(fb, bounds.x1, bounds.y1,
+			       bounds.x2 - bounds.x1, bounds.y2 - bounds.y1);
+	fb_cairo_invalidate(fb);
+	kms_framebuffer_unmap(fb);
+
+	if (box)
+		*box = bounds;
 
 	return 0;
 }
@@ -165,32 +757,29 @@ static int draw_vertical_gradient(cairo_t *cr, uint32_t colors[2])
 
 int render_fb_checker_pattern(struct kms_framebuffer* fb, uint32_t color1, uint32_t color2)
 {
-	void* ptr;
-	int err;
 	cairo_t* cr;
-	cairo_surface_t* surface;
 	uint32_t colors[2] = { color1, color2 };
-	cairo_format_t cairo_format = drm2cairo(fb->format);
+	struct blit_buffer buf;
 
-	err = kms_framebuffer_map(fb, &ptr);
-	if (err < 0) {
-		LOG("error: kms_framebuffer_map() failed: %s\n",
-		    strerror(-err));
-		return -1;
-	}
+	/* translucent colors are blended with the framebuffer by cairo */
+	if ((color1 & 0xff) == 0xff && (color2 & 0xff) == 0xff &&
+	    fb_fill_begin(fb, &buf)) {
+		uint32_t argb[2] = { rgba_to_argb(color1), rgba_to_argb(color2) };
 
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
+		blit_fill_checker(&buf, argb, 16);
+		fb_fill_end(fb);
 
-	draw_checker_pattern(cr, colors, cairo_format);
+		return 0;
+	}
 
-	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
+	cr = fb_cairo_get(fb);
+	if (!cr)
+		return -1;
 
-	kms_framebuffer_unmap(fb);
+	draw_checker_pattern(cr, colors,
+			     cairo_image_surface_get_format(cairo_get_target(cr)));
+
+	fb_cairo_put(fb, cr);
 
 	return 0;
 }
@@ -226,32 +815,15 @@ static void draw_mesh(cairo_t* cr, int width, int height)
 
 int render_fb_mesh_pattern(struct kms_framebuffer* fb)
 {
-	void* ptr;
-	int err;
 	cairo_t* cr;
-	cairo_surface_t* surface;
-	cairo_format_t cairo_format = drm2cairo(fb->format);
 
-	err = kms_framebuffer_map(fb, &ptr);
-	if (err < 0) {
-		LOG("error: kms_framebuffer_map() failed: %s\n",
-		    strerror(-err));
+	cr = fb_cairo_get(fb);
+	if (!cr)
 		return -1;
-	}
-
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
-
 
 	draw_mesh(cr, fb->width, fb->height);
 
-	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
-
-	kms_framebuffer_unmap(fb);
+	fb_cairo_put(fb, cr);
 
 	return 0;
 }
@@ -259,32 +831,43 @@ int render_fb_mesh_pattern(struct kms_framebuffer* fb)
 int render_fb_vgradient(struct kms_framebuffer* fb, uint32_t color1,
 			uint32_t color2)
 {
-	void* ptr;
-	int err;
 	cairo_t* cr;
-	cairo_surface_t* surface;
 	uint32_t colors[2] = { color1, color2 };
-	cairo_format_t cairo_format = drm2cairo(fb->format);
+	struct blit_buffer buf;
 
-	err = kms_framebuffer_map(fb, &ptr);
-	if (err < 0) {
-		LOG("error: kms_framebuffer_map() failed: %s\n",
-		    strerror(-err));
-		return -1;
+	/*
+	 * Same gradient as draw_vertical_gradient(), sampled at the center of each
+	 * row: the first color at the top and bottom, the second in the middle.
+	 */
+	if (fb_fill_begin(fb, &buf)) {
+		uint32_t top = rgba_to_argb(color1);
+		uint32_t middle = rgba_to_argb(color2);
+		unsigned int y;
+
+		for (y = 0; y < fb->height; y++) {
+			double t = (y + 0.5) / fb->height;
+			uint32_t argb;
+
+			if (t < 0.5)
+				argb = lerp_argb(top, middle, t * 2);
+			else
+				argb = lerp_argb(middle, top, (t - 0.5) * 2);
+
+			blit_fill(&buf, argb, 0, y, fb->width, 1);
+		}
+
+		fb_fill_end(fb);
+
+		return 0;
 	}
 
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
+	cr = fb_cairo_get(fb);
+	if (!cr)
+		return -1;
 
 	draw_vertical_gradient(cr, colors);
 
-	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
-
-	kms_framebuffer_unmap(fb);
+	fb_cairo_put(fb, cr);
 
 	return 0;
 }
@@ -320,55 +903,483 @@ scale_surface(cairo_surface_t *old_surface,
 	return new_surface;
 }
 
-int render_fb_image(struct kms_framebuffer* fb, const char* filename)
-{
-	void* ptr;
-	int err;
-	cairo_t* cr;
-	cairo_surface_t* surface;
+#define IMAGE_CACHE_SIZE 16
+/* memory the decoded images may take, least recently used ones go first */
+#define IMAGE_CACHE_BYTES (16 * 1024 * 1024)
+#define IMAGE_FILE_MAGIC 0x43494c50 /* "PLIC" */
+
+/*
+ * Decoded images, scaled to the size they were drawn at. The file is
+ * identified by its path, modification time and size, so an image replaced on
+ * disk is decoded again.
+ */
+struct image_entry {
+	char* path;
+	struct timespec mtime;
+	off_t size;
+	int width;
+	int height;
+	/* ARGB32 pixels at width x height */
 	cairo_surface_t* image;
-	cairo_format_t cairo_format = drm2cairo(fb->format);
+	bool opaque;
+	/*
+	 * The pixels converted to native_format, for opaque images drawn more
+	 * than once only.
+	 */
+	uint8_t* native;
+	uint32_t native_format;
+	unsigned int native_pitch;
+	unsigned int uses;
+	unsigned int last_use;
+};
+
+/* header of the files in the on-disk cache, followed by the pixels */
+struct image_file {
+	uint32_t magic;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+};
+
+static struct image_entry image_cache[IMAGE_CACHE_SIZE];
+static size_t image_cache_bytes;
+static unsigned int image_use;
+static char* image_cache_dir;
+static bool image_cache_dir_set;
+
+static size_t image_entry_bytes(const struct image_entry* e)
+{
+	size_t bytes = 0;
 
-	err = kms_framebuffer_map(fb, &ptr);
-	if (err < 0) {
-		LOG("error: kms_framebuffer_map() failed: %s\n",
-		    strerror(-err));
-		return -1;
+	if (e->image)
+		bytes += (size_t)cairo_image_surface_get_stride(e->image) *
+			e->height;
+	if (e->native)
+		bytes += (size_t)e->native_pitch * e->height;
+
+	return bytes;
+}
+
+static void image_entry_free(struct image_entry* e)
+{
+	image_cache_bytes -= image_entry_bytes(e);
+
+	if (e->image)
+		cairo_surface_destroy(e->image);
+	free(e->native);
+	free(e->path);
+	memset(e, 0, sizeof(*e));
+}
+
+/*
+ * Evict the least recently used entries other than keep until bytes more fit
+ * in the cache. Returns false if they still don't.
+ */
+static bool image_cache_trim(const struct image_entry* keep, size_t bytes)
+{
+	struct image_entry* lru;
+	unsigned int i;
+
+	while (image_cache_bytes + bytes > IMAGE_CACHE_BYTES) {
+		lru = NULL;
+
+		for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+			struct image_entry* c = &image_cache[i];
+
+			if (c == keep || !c->path)
+				continue;
+
+			if (!lru || c->last_use < lru->last_use)
+				lru = c;
+		}
+
+		if (!lru)
+			return false;
+
+		image_entry_free(lru);
 	}
 
-	LOG("loading image %s ... ", filename);
+	return true;
+}
 
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
+void image_cache_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+		image_entry_free(&image_cache[i]);
+}
+
+int image_cache_set_dir(const char* dir)
+{
+	char* copy = NULL;
+
+	if (dir) {
+		if (mkdir(dir, 0755) && errno != EEXIST) {
+			LOG("error: can't create image cache %s: %s\n", dir,
+			    strerror(errno));
+			return -errno;
+		}
+
+		copy = strdup(dir);
+		if (!copy)
+			return -ENOMEM;
+	}
+
+	free(image_cache_dir);
+	image_cache_dir = copy;
+	image_cache_dir_set = true;
+
+	return 0;
+}
+
+static const char* image_cache_get_dir(void)
+{
+	/* unless told otherwise, the environment says where the cache is */
+	if (!image_cache_dir_set) {
+		const char* dir = getenv("LIBPLANES_IMAGE_CACHE");
+
+		image_cache_set_dir(dir && *dir ? dir : NULL);
+	}
+
+	return image_cache_dir;
+}
+
+/*
+ * Name of the file caching an image in dir, from a hash of what identifies
+ * the image.
+ */
+static void image_file_name(const struct image_entry* e, const char* dir,
+			    char* name, size_t size)
+{
+	uint64_t h = 14695981039346656037ull;
+	uint64_t key[5] = {
+		e->mtime.tv_sec, e->mtime.tv_nsec, e->size, e->width, e->height
+	};
+	const uint8_t* p;
+	size_t i;
+
+	for (p = (const uint8_t*)e->path; *p; p++)
+		h = (h ^ *p) * 1099511628211ull;
+	for (p = (const uint8_t*)key, i = 0; i < sizeof(key); i++)
+		h = (h ^ p[i]) * 1099511628211ull;
+
+	snprintf(name, size, "%s/%016llx.argb", dir, (unsigned long long)h);
+}
+
+static cairo_surface_t* image_file_load(const char* name, int width, int height)
+{
+	cairo_surface_t* image = NULL;
+	struct image_file header;
+	FILE* f;
+
+	f = fopen(name, "rb");
+	if (!f)
+		return NULL;
+
+	if (fread(&header, sizeof(header), 1, f) == 1 &&
+	    header.magic == IMAGE_FILE_MAGIC &&
+	    header.width == (uint32_t)width && header.height == (uint32_t)height) {
+		image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+
+		if ((int)header.stride != cairo_image_surface_get_stride(image) ||
+		    fread(cairo_image_surface_get_data(image), header.stride,
+			  height, f) != (size_t)height) {
+			cairo_surface_destroy(image);
+			image = NULL;
+		} else {
+			cairo_surface_mark_dirty(image);
+		}
+	}
+
+	fclose(f);
+
+	return image;
+}
+
+static void image_file_store(const char* name, cairo_surface_t* image)
+{
+	struct image_file header;
+	char tmp[PATH_MAX];
+	FILE* f;
+
+	header.magic = IMAGE_FILE_MAGIC;
+	header.width = cairo_image_surface_get_width(image);
+	header.height = cairo_image_surface_get_height(image);
+	header.stride = cairo_image_surface_get_stride(image);
+
+	/* written aside and renamed, so readers never see half a file */
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, getpid());
+
+	f = fopen(tmp, "wb");
+	if (!f) {
+		LOG("error: can't write image cache %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+
+	cairo_surface_flush(image);
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+	    fwrite(cairo_image_surface_get_data(image), header.stride,
+		   header.height, f) != header.height) {
+		LOG("error: can't write image cache %s\n", tmp);
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+
+	fclose(f);
+
+	if (rename(tmp, name))
+		unlink(tmp);
+}
+
+/*
+ * Decode the image and bring it to the given size, as ARGB32.
+ */
+static cairo_surface_t* image_decode(const char* filename, int width,
+				     int height)
+{
+	cairo_surface_t* image;
+	cairo_surface_t* argb;
+	cairo_t* cr;
+
+	LOG("loading image %s ... ", filename);
 
 	image = cairo_image_surface_create_from_png(filename);
+	if (cairo_surface_status(image)) {
+		LOG("error: %s\n", cairo_status_to_string(cairo_surface_status(image)));
+		cairo_surface_destroy(image);
+		return NULL;
+	}
 
 	LOG("size %dx%d\n",
 	    cairo_image_surface_get_width(image),
 	    cairo_image_surface_get_height(image));
 
-	if (cairo_image_surface_get_width(image) != (int)fb->width ||
-	    cairo_image_surface_get_height(image) != (int)fb->height) {
-
-		LOG("image scaled to %dx%d\n", fb->width, fb->height);
-		image = scale_surface(image,
-				      cairo_image_surface_get_width(image),
-				      cairo_image_surface_get_height(image),
-				      fb->width,
-				      fb->height);
+	if (cairo_image_surface_get_width(image) != width ||
+	    cairo_image_surface_get_height(image) != height) {
+		cairo_surface_t* scaled;
+
+		LOG("image scaled to %dx%d\n", width, height);
+		scaled = scale_surface(image,
+				       cairo_image_surface_get_width(image),
+				       cairo_image_surface_get_height(image),
+				       width, height);
+		cairo_surface_destroy(image);
+		image = scaled;
 	}
 
+	if (cairo_image_surface_get_format(image) == CAIRO_FORMAT_ARGB32)
+		return image;
+
+	/* opaque PNGs decode to RGB24, whose padding byte isn't defined */
+	argb = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cr = cairo_create(argb);
 	cairo_set_source_surface(cr, image, 0, 0);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint(cr);
+	cairo_destroy(cr);
 	cairo_surface_destroy(image);
 
-	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
+	return argb;
+}
 
-	kms_framebuffer_unmap(fb);
+static bool image_is_opaque(cairo_surface_t* image)
+{
+	const uint8_t* data = cairo_image_surface_get_data(image);
+	int stride = cairo_image_surface_get_stride(image);
+	int width = cairo_image_surface_get_width(image);
+	int height = cairo_image_surface_get_height(image);
+	int x, y;
+
+	cairo_surface_flush(image);
+
+	for (y = 0; y < height; y++) {
+		const uint32_t* row = (const uint32_t*)(data + y * stride);
+
+		for (x = 0; x < width; x++)
+			if ((row[x] >> 24) != 0xff)
+				return false;
+	}
+
+	return true;
+}
+
+static struct image_entry* image_cache_get(const char* filename, int width,
+					   int height)
+{
+	struct image_entry* e = NULL;
+	const char* dir;
+	char name[PATH_MAX];
+	struct stat st;
+	unsigned int i;
+
+	if (stat(filename, &st)) {
+		LOG("error: can't open image %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		struct image_entry* c = &image_cache[i];
+
+		if (c->path && !strcmp(c->path, filename) &&
+		    c->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    c->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+		    c->size == st.st_size &&
+		    c->width == width && c->height == height) {
+			c->uses++;
+			c->last_use = ++image_use;
+			return c;
+		}
+	}
+
+	/* take a free entry, or the least recently used one */
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+		if (!e || !image_cache[i].path ||
+		    (e->path && image_cache[i].last_use < e->last_use))
+			e = &image_cache[i];
+
+	image_entry_free(e);
+
+	e->path = strdup(filename);
+	if (!e->path)
+		return NULL;
+
+	e->mtime = st.st_mtim;
+	e->size = st.st_size;
+	e->width = width;
+	e->height = height;
+
+	dir = image_cache_get_dir();
+	if (dir) {
+		image_file_name(e, dir, name, sizeof(name));
+		e->image = image_file_load(name, width, height);
+	}
+
+	if (!e->image) {
+		e->image = image_decode(filename, width, height);
+		if (!e->image) {
+			image_entry_free(e);
+			return NULL;
+		}
+
+		if (dir)
+			image_file_store(name, e->image);
+	}
+
+	e->opaque = image_is_opaque(e->image);
+	e->uses = 1;
+	e->last_use = ++image_use;
+
+	/* an image larger than the cache still stays until the next one */
+	image_cache_bytes += image_entry_bytes(e);
+	image_cache_trim(e, 0);
+
+	return e;
+}
+
+/*
+ * Get the pixels of an opaque image in the given packed RGB format, and their
+ * pitch.
+ */
+static const uint8_t* image_entry_native(struct image_entry* e, uint32_t format,
+					 unsigned int* pitch)
+{
+	struct blit_buffer buf;
+	size_t bytes;
+	int bpp;
+
+	if (!e->opaque || blit_format_is_yuv(format) ||
+	    !blit_format_convertible(format))
+		return NULL;
+
+	/* cairo already has them in this format */
+	if (format == DRM_FORMAT_XRGB8888 || format == DRM_FORMAT_ARGB8888) {
+		cairo_surface_flush(e->image);
+		*pitch = cairo_image_surface_get_stride(e->image);
+		return cairo_image_surface_get_data(e->image);
+	}
+
+	if (e->native && e->native_format == format) {
+		*pitch = e->native_pitch;
+		return e->native;
+	}
+
+	/* converting only pays off for an image drawn again */
+	if (e->uses < 2)
+		return NULL;
+
+	image_cache_bytes -= image_entry_bytes(e);
+	free(e->native);
+	e->native = NULL;
+	image_cache_bytes += image_entry_bytes(e);
+
+	bpp = kms_format_bpp(format);
+	bytes = (size_t)e->width * (bpp / 8) * e->height;
+	if (!image_cache_trim(e, bytes))
+		return NULL;
+
+	e->native = malloc(bytes);
+	if (!e->native)
+		return NULL;
+
+	e->native_pitch = e->width * (bpp / 8);
+	image_cache_bytes += bytes;
+
+	buf.ptr = e->native;
+	buf.pitch = e->native_pitch;
+	buf.width = e->width;
+	buf.height = e->height;
+	buf.format = format;
+
+	blit_pack(&buf, (const uint32_t*)cairo_image_surface_get_data(e->image),
+		  cairo_image_surface_get_stride(e->image),
+		  0, 0, e->width, e->height);
+	e->native_format = format;
+
+	*pitch = e->native_pitch;
+
+	return e->native;
+}
+
+int render_fb_image(struct kms_framebuffer* fb, const char* filename)
+{
+	struct image_entry* e;
+	const uint8_t* native;
+	unsigned int pitch;
+	cairo_t* cr;
+	void* ptr;
+	unsigned int y;
+
+	e = image_cache_get(filename, fb->width, fb->height);
+	if (!e)
+		return -1;
+
+	/* an opaque image replaces the content, a copy is enough */
+	native = image_entry_native(e, fb->format, &pitch);
+	if (native && !kms_framebuffer_map(fb, &ptr)) {
+		size_t row = fb->width * (kms_format_bpp(fb->format) / 8);
+
+		for (y = 0; y < fb->height; y++)
+			memcpy((uint8_t*)ptr + y * fb->pitch, native + y * pitch,
+			       row);
+
+		kms_framebuffer_damage(fb, 0, 0, fb->width, fb->height);
+		fb_cairo_invalidate(fb);
+		kms_framebuffer_unmap(fb);
+
+		return 0;
+	}
+
+	cr = fb_cairo_get(fb);
+	if (!cr)
+		return -1;
+
+	cairo_set_source_surface(cr, e->image, 0, 0);
+	cairo_paint(cr);
+
+	fb_cairo_put(fb, cr);
 
 	return 0;
 }
@@ -408,6 +1419,8 @@ int render_fb_image_raw(struct kms_framebuffer* fb, const char* filename)
 				     fb->width * fb->height * kms_format_bpp(fb->format) / 8));
 
 		free(img);
+		kms_framebuffer_damage(fb, 0, 0, fb->width, fb->height);
+		fb_cairo_invalidate(fb);
 	} else {
 		LOG("error: failed to open file: %s\n", filename);
 	}
@@ -417,69 +1430,83 @@ int render_fb_image_raw(struct kms_framebuffer* fb, const char* filename)
 	return 0;
 }
 
-int flip_fb_horizontal(struct kms_framebuffer* fb)
+/*
+ * Clip the rectangle to the framebuffer.
+ * @return false if nothing is left.
+ */
+static bool clip_rect(struct kms_framebuffer* fb, int* x, int* y,
+		      int* width, int* height)
+{
+	int x2 = MIN(*x + *width, (int)fb->width);
+	int y2 = MIN(*y + *height, (int)fb->height);
+
+	*x = MAX(*x, 0);
+	*y = MAX(*y, 0);
+	*width = x2 - *x;
+	*height = y2 - *y;
+
+	return *width > 0 && *height > 0;
+}
+
+/*
+ * Flip a rectangle through cairo, for pixel formats the native kernels don't
+ * handle. This paints through a temporary copy of the rectangle.
+ */
+static int flip_fb_rect_cairo(struct kms_framebuffer* fb, int x, int y,
+			      int width, int height, bool horizontal)
 {
-	void* ptr;
-	int err;
 	cairo_t* cr;
 	cairo_t* cr2;
-	cairo_surface_t* surface;
 	cairo_surface_t* surface2;
 	cairo_matrix_t matrix;
-	cairo_format_t cairo_format = drm2cairo(fb->format);
 
-	err = kms_framebuffer_map(fb, &ptr);
-	if (err < 0) {
-		LOG("error: kms_framebuffer_map() failed: %s\n",
-		    strerror(-err));
+	cr = fb_cairo_get(fb);
+	if (!cr)
 		return -1;
-	}
-
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
 
-	surface2 = cairo_image_surface_create(cairo_format,
-					      fb->width, fb->height);
+	surface2 = cairo_image_surface_create(cairo_image_surface_get_format(cairo_get_target(cr)),
+					      width, height);
 
 	cr2 = cairo_create(surface2);
 
-	cairo_set_source_surface(cr2, surface, 0, 0);
+	cairo_set_source_surface(cr2, cairo_get_target(cr), -x, -y);
 	cairo_paint(cr2);
-
+	cairo_destroy(cr2);
 
 	cairo_matrix_init_identity(&matrix);
-	matrix.xx = -1.0;
-	matrix.x0 = fb->width;
+	if (horizontal) {
+		matrix.xx = -1.0;
+		matrix.x0 = 2 * x + width;
+	} else {
+		matrix.yy = -1.0;
+		matrix.y0 = 2 * y + height;
+	}
 	cairo_set_matrix(cr, &matrix);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source_surface(cr, surface2, 0, 0);
-	cairo_paint(cr);
-
-	cairo_surface_destroy(surface);
-	cairo_surface_destroy(surface2);
+	cairo_set_source_surface(cr, surface2, x, y);
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_fill(cr);
 
-	cairo_destroy(cr);
-	cairo_destroy(cr2);
+	fb_cairo_put_rect(fb, cr, x, y, width, height);
 
-	kms_framebuffer_unmap(fb);
+	cairo_surface_destroy(surface2);
 
 	return 0;
 }
 
-int flip_fb_vertical(struct kms_framebuffer* fb)
+static int flip_fb_rect(struct kms_framebuffer* fb, int x, int y,
+			int width, int height, bool horizontal)
 {
 	void* ptr;
 	int err;
-	cairo_t* cr;
-	cairo_t* cr2;
-	cairo_surface_t* surface;
-	cairo_surface_t* surface2;
-	cairo_matrix_t matrix;
-	cairo_format_t cairo_format = drm2cairo(fb->format);
+
+	if (!clip_rect(fb, &x, &y, &width, &height))
+		return 0;
+
+	/* the kernels work on whole pixels, not on YUV samples */
+	if (blit_format_is_yuv(fb->format))
+		return flip_fb_rect_cairo(fb, x, y, width, height, horizontal);
 
 	err = kms_framebuffer_map(fb, &ptr);
 	if (err < 0) {
@@ -488,36 +1515,45 @@ int flip_fb_vertical(struct kms_framebuffer* fb)
 		return -1;
 	}
 
-	surface = cairo_image_surface_create_for_data(ptr,
-						      cairo_format,
-						      fb->width, fb->height,
-						      cairo_format_stride_for_width(cairo_format, fb->width));
-	cr = cairo_create(surface);
-
-	surface2 = cairo_image_surface_create(cairo_format,
-					      fb->width, fb->height);
-
-	cr2 = cairo_create(surface2);
+	if (horizontal)
+		err = blit_flip_horizontal(ptr, fb->pitch,
+					   kms_format_bpp(fb->format),
+					   x, y, width, height);
+	else
+		err = blit_flip_vertical(ptr, fb->pitch,
+					 kms_format_bpp(fb->format),
+					 x, y, width, height);
+	if (!err) {
+		kms_framebuffer_damage(fb, x, y, width, height);
+		fb_cairo_invalidate(fb);
+	}
 
-	cairo_set_source_surface(cr2, surface, 0, 0);
-	cairo_paint(cr2);
+	kms_framebuffer_unmap(fb);
 
-	cairo_matrix_init_identity(&matrix);
-	matrix.yx = -1.0;
-	matrix.y0 = fb->height;
-	cairo_set_matrix(cr, &matrix);
+	if (err)
+		return flip_fb_rect_cairo(fb, x, y, width, height, horizontal);
 
-	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source_surface(cr, surface2, 0, 0);
-	cairo_paint(cr);
+	return 0;
+}
 
-	cairo_surface_destroy(surface);
-	cairo_surface_destroy(surface2);
+int flip_fb_horizontal_rect(struct kms_framebuffer* fb, int x, int y,
+			    int width, int height)
+{
+	return flip_fb_rect(fb, x, y, width, height, true);
+}
 
-	cairo_destroy(cr);
-	cairo_destroy(cr2);
+int flip_fb_vertical_rect(struct kms_framebuffer* fb, int x, int y,
+			  int width, int height)
+{
+	return flip_fb_rect(fb, x, y, width, height, false);
+}
 
-	kms_framebuffer_unmap(fb);
+int flip_fb_horizontal(struct kms_framebuffer* fb)
+{
+	return flip_fb_rect(fb, 0, 0, fb->width, fb->height, true);
+}
 
-	return 0;
+int flip_fb_vertical(struct kms_framebuffer* fb)
+{
+	return flip_fb_rect(fb, 0, 0, fb->width, fb->height, false);
 }
@@ -8,8 +8,32 @@
 
 #include "common.h"
 
+static const char *const prop_names[DRM_OBJ_PROP_COUNT] = {
+	[DRM_OBJ_PROP_FB_ID] = "FB_ID",
+	[DRM_OBJ_PROP_CRTC_ID] = "CRTC_ID",
+	[DRM_OBJ_PROP_SRC_X] = "SRC_X",
+	[DRM_OBJ_PROP_SRC_Y] = "SRC_Y",
+	[DRM_OBJ_PROP_SRC_W] = "SRC_W",
+	[DRM_OBJ_PROP_SRC_H] = "SRC_H",
+	[DRM_OBJ_PROP_CRTC_X] = "CRTC_X",
+	[DRM_OBJ_PROP_CRTC_Y] = "CRTC_Y",
+	[DRM_OBJ_PROP_CRTC_W] = "CRTC_W",
+	[DRM_OBJ_PROP_CRTC_H] = "CRTC_H",
+	[DRM_OBJ_PROP_ALPHA] = "alpha",
+	[DRM_OBJ_PROP_ROTATION] = "rotation",
+	[DRM_OBJ_PROP_MODE_ID] = "MODE_ID",
+	[DRM_OBJ_PROP_ACTIVE] = "ACTIVE",
+	[DRM_OBJ_PROP_OUT_FENCE_PTR] = "OUT_FENCE_PTR",
+	[DRM_OBJ_PROP_IN_FENCE_FD] = "IN_FENCE_FD",
+	[DRM_OBJ_PROP_FB_DAMAGE_CLIPS] = "FB_DAMAGE_CLIPS",
+};
+
 int drm_obj_get_properties(int fd, struct drm_object *obj, uint32_t type)
 {
+	obj->props_info = NULL;
+	obj->prop_valid = 0;
+	memset(obj->prop_ids, 0, sizeof(obj->prop_ids));
+
 	obj->props = drmModeObjectGetProperties(fd, obj->id, type);
 	if (!obj->props) {
 		LOG("error: cannot get object properties (drm object: %p, type: %u)\n", obj, type);
@@ -22,8 +46,18 @@ int drm_obj_get_properties(int fd, struct drm_object *obj, uint32_t type)
 		return -ENOMEM;
 	}
 
-	for (unsigned int i = 0; i < obj->props->count_props; i++)
+	for (unsigned int i = 0; i < obj->props->count_props; i++) {
 		obj->props_info[i] = drmModeGetProperty(fd, obj->props->props[i]);
+		if (!obj->props_info[i])
+			continue;
+
+		for (unsigned int j = 0; j < DRM_OBJ_PROP_COUNT; j++) {
+			if (!strcmp(obj->props_info[i]->name, prop_names[j])) {
+				obj->prop_ids[j] = obj->props_info[i]->prop_id;
+				break;
+			}
+		}
+	}
 
 	return 0;
 }
@@ -34,7 +68,7 @@ int drm_obj_set_property(drmModeAtomicReq *req, struct drm_object *obj, const ch
 	int ret;
 
 	for (unsigned int i = 0; i < obj->props->count_props; i++) {
-		if (!strcmp(obj->props_info[i]->name, name)) {
+		if (obj->props_info[i] && !strcmp(obj->props_info[i]->name, name)) {
 			prop_id = obj->props_info[i]->prop_id;
 			break;
 		}
@@ -58,6 +92,56 @@ int drm_obj_set_property(drmModeAtomicReq *req, struct drm_object *obj, const ch
 		return 0;
 }
 
+int drm_obj_set_prop(drmModeAtomicReq *req, struct drm_object *obj, enum drm_obj_prop prop, uint64_t value)
+{
+	int ret;
+
+	if (!obj->prop_ids[prop]) {
+		LOG("error: %s property not found\n", prop_names[prop]);
+		return -ENOENT;
+	}
+
+	ret = drmModeAtomicAddProperty(req, obj->id, obj->prop_ids[prop], value);
+
+	return ret < 0 ? ret : 0;
+}
+
+bool drm_obj_has_prop(struct drm_object *obj, enum drm_obj_prop prop)
+{
+	return obj->prop_ids[prop] != 0;
+}
+
+/*
+ * Same as drm_obj_set_prop(), but nothing is added to the request if the value
+ * is the one that has been sent last time.
+ */
+int drm_obj_update_prop(drmModeAtomicReq *req, struct drm_object *obj, enum drm_obj_prop prop, uint64_t value)
+{
+	int ret;
+
+	if ((obj->prop_valid & (1u << prop)) && obj->prop_values[prop] == value)
+		return 0;
+
+	ret = drm_obj_set_prop(req, obj, prop, value);
+	if (ret)
+		return ret;
+
+	obj->prop_values[prop] = value;
+	obj->prop_valid |= 1u << prop;
+
+	return 0;
+}
+
+/*
+ * Forget the last values sent for the properties in mask, they will be sent
+ * again on the next update. Used when the kernel state can't be trusted to
+ * match, for example because a request has been dropped.
+ */
+void drm_obj_invalidate_props(struct drm_object *obj, uint32_t mask)
+{
+	obj->prop_valid &= ~mask;
+}
+
 void drm_obj_free(struct drm_object *obj)
 {
 	if (!obj)
@@ -1,22 +1,61 @@
 #ifndef PLANES_DRM_OBJECT_H
 #define PLANES_DRM_OBJECT_H
 
+#include <stdbool.h>
 #include <xf86drmMode.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Well known properties, resolved once when the object properties are fetched
+ * so the per frame path doesn't have to look them up by name.
+ */
+enum drm_obj_prop {
+	DRM_OBJ_PROP_FB_ID,
+	DRM_OBJ_PROP_CRTC_ID,
+	DRM_OBJ_PROP_SRC_X,
+	DRM_OBJ_PROP_SRC_Y,
+	DRM_OBJ_PROP_SRC_W,
+	DRM_OBJ_PROP_SRC_H,
+	DRM_OBJ_PROP_CRTC_X,
+	DRM_OBJ_PROP_CRTC_Y,
+	DRM_OBJ_PROP_CRTC_W,
+	DRM_OBJ_PROP_CRTC_H,
+	DRM_OBJ_PROP_ALPHA,
+	DRM_OBJ_PROP_ROTATION,
+	DRM_OBJ_PROP_MODE_ID,
+	DRM_OBJ_PROP_ACTIVE,
+	DRM_OBJ_PROP_OUT_FENCE_PTR,
+	DRM_OBJ_PROP_IN_FENCE_FD,
+	DRM_OBJ_PROP_FB_DAMAGE_CLIPS,
+	DRM_OBJ_PROP_COUNT
+};
+
 struct drm_object {
 	drmModeObjectProperties *props;
 	drmModePropertyRes **props_info;
 	uint32_t id;
+	/* property ids indexed by enum drm_obj_prop, zero if not available */
+	uint32_t prop_ids[DRM_OBJ_PROP_COUNT];
+	/* last value sent for each property whose bit is set in prop_valid */
+	uint64_t prop_values[DRM_OBJ_PROP_COUNT];
+	uint32_t prop_valid;
 };
 
 int drm_obj_get_properties(int fd, struct drm_object *obj, uint32_t type);
 
 int drm_obj_set_property(drmModeAtomicReq *req, struct drm_object *obj, const char *name, uint64_t value);
 
+int drm_obj_set_prop(drmModeAtomicReq *req, struct drm_object *obj, enum drm_obj_prop prop, uint64_t value);
+
+bool drm_obj_has_prop(struct drm_object *obj, enum drm_obj_prop prop);
+
+int drm_obj_update_prop(drmModeAtomicReq *req, struct drm_object *obj, enum drm_obj_prop prop, uint64_t value);
+
+void drm_obj_invalidate_props(struct drm_object *obj, uint32_t mask);
+
 void drm_obj_free(struct drm_object *obj);
 
 #ifdef __cplusplus
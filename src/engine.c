@@ -28,10 +28,17 @@
 #include "script.h"
 
 #include <cairo.h>
+#include <ctype.h>
 #include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
@@ -55,11 +62,52 @@ static void configure_plane(struct plane_data* plane, uint32_t colors[2],
 	if (filename_raw)
 		render_fb_image_raw(plane->fbs[0], filename_raw);
 
-	for (x = 0; x < 255;x++)
-		if (strlen(plane->text[x].str))
-			render_fb_text(plane->fbs[0], plane->text[x].x, plane->text[x].y,
-				       plane->text[x].str, plane->text[x].color,
-				       plane->text[x].size);
+	for (x = 0; x < (int)plane->text_count; x++)
+		render_fb_text(plane->fbs[0], plane->text[x].x, plane->text[x].y,
+			       plane->text[x].str, plane->text[x].color,
+			       plane->text[x].size);
+
+	for (x = 1; x < (int)plane->buffer_count; x++)
+		plane_fb_copy(plane, x, 0);
+}
+
+/*
+ * Flip the content of the plane. With more than one framebuffer this is done
+ * in a back buffer queued for display, so the one on screen is never drawn to.
+ */
+static void flip_plane(struct plane_data* plane, bool horizontal, bool vertical)
+{
+	struct kms_framebuffer* fb = plane->fbs[plane->front_buf];
+	int back = plane_acquire(plane);
+
+	if (back >= 0) {
+		if (plane_fb_copy(plane, back, plane->front_buf)) {
+			plane_release(plane, back);
+			back = -1;
+		} else {
+			fb = plane->fbs[back];
+		}
+	}
+
+	if (horizontal)
+		flip_fb_horizontal(fb);
+	if (vertical)
+		flip_fb_vertical(fb);
+
+	if (back >= 0)
+		plane_queue(plane, back);
+}
+
+/*
+ * Render the flipped content of a plane in its second framebuffer, so that
+ * transform triggers only have to select the other framebuffer.
+ */
+static void prerender_flip(struct plane_data* plane)
+{
+	if (plane->transform_flags & TRANSFORM_FLIP_HORIZONTAL)
+		flip_fb_horizontal(plane->fbs[1]);
+	if (plane->transform_flags & TRANSFORM_FLIP_VERTICAL)
+		flip_fb_vertical(plane->fbs[1]);
 }
 
 /*
@@ -143,6 +191,7 @@ struct
 	{"flip-vertical", TRANSFORM_FLIP_VERTICAL},
 	{"rotate-clockwise", TRANSFORM_ROTATE_CLOCKWISE},
 	{"rotate-cclockwise", TRANSFORM_ROTATE_CCLOCKWISE},
+	{"prerender", TRANSFORM_PRERENDER},
 };
 
 static int plane_string_to_type(const char* str)
@@ -184,6 +233,10 @@ static int check_plane_exist(lua_State* state)
 	return 1;
 }
 
+/* size of the screen configs are written for, see physicalw() and physicalh() */
+#define LOGICAL_WIDTH 800
+#define LOGICAL_HEIGHT 480
+
 static int logical_to_physical_width(lua_State* state)
 {
 	double width = lua_tonumber(state, 1);
@@ -206,34 +259,49 @@ static int logical_to_physical_height(lua_State* state)
 	return 1;
 }
 
+/*
+ * All expressions run in the same Lua state, set up on first use.
+ */
+static bool lua_setup(struct kms_device* device)
+{
+	static bool ready;
+
+	if (!ready) {
+		if (!script_init(NULL)) {
+			LOG("can't init lua\n");
+			return false;
+		}
+
+		script_setfunc("checkplane", check_plane_exist);
+		script_setfunc("physicalw", logical_to_physical_width);
+		script_setfunc("physicalh", logical_to_physical_height);
+		script_setvar("LOGICAL_WIDTH", LOGICAL_WIDTH);
+		script_setvar("LOGICAL_HEIGHT", LOGICAL_HEIGHT);
+		ready = true;
+	}
+
+	script_setptr("device", device);
+	script_setvar("SCREEN_WIDTH", device->screens[0]->width);
+	script_setvar("SCREEN_HEIGHT", device->screens[0]->height);
+
+	return true;
+}
+
 static double lua_evaluate(const char* expr, struct kms_device* device)
 {
 	int cookie;
 	char *msg = NULL;
 	double y = 0.;
 
-	lua_State* state = luaL_newstate();
-	lua_pushlightuserdata(state, device);
-	lua_setglobal(state, "device");
-
-	if (!script_init(state)) {
-		LOG("can't init lua\n");
+	if (!lua_setup(device))
 		return y;
-	}
+
 	cookie = script_load(expr, &msg);
 	if (msg) {
 		LOG("can't load expr: %s\n", msg);
 		goto error;
 	}
 
-	script_setfunc("checkplane", check_plane_exist);
-	script_setfunc("physicalw", logical_to_physical_width);
-	script_setfunc("physicalh", logical_to_physical_height);
-	script_setvar("SCREEN_WIDTH", device->screens[0]->width);
-	script_setvar("SCREEN_HEIGHT", device->screens[0]->height);
-	script_setvar("LOGICAL_WIDTH", 800);
-	script_setvar("LOGICAL_HEIGHT", 480);
-
 	y = script_eval(cookie, &msg);
 	if (msg) {
 		LOG("can't eval: %s\n", msg);
@@ -248,6 +316,173 @@ error:
 	return y;
 }
 
+/*
+ * Most config expressions are plain arithmetic on numbers, the screen size and
+ * physicalw() or physicalh(). These are evaluated here rather than in Lua, which
+ * is slow to enter on small parts. Anything else makes the parser give up and
+ * the expression goes to Lua.
+ */
+struct expr_parser
+{
+	const char* p;
+	struct kms_device* device;
+	bool error;
+};
+
+static double expr_sum(struct expr_parser* e);
+
+static void expr_skip(struct expr_parser* e)
+{
+	while (isspace((unsigned char)*e->p))
+		e->p++;
+}
+
+static bool expr_accept(struct expr_parser* e, char c)
+{
+	expr_skip(e);
+	if (*e->p != c)
+		return false;
+
+	/* a Lua comment */
+	if (c == '-' && e->p[1] == '-') {
+		e->error = true;
+		return false;
+	}
+
+	e->p++;
+	return true;
+}
+
+static bool expr_ident(struct expr_parser* e, const char* start, size_t len,
+		       const char* name)
+{
+	return len == strlen(name) && !strncmp(start, name, len);
+}
+
+static double expr_primary(struct expr_parser* e)
+{
+	const char* start;
+	size_t len;
+	double v;
+
+	expr_skip(e);
+
+	if (isdigit((unsigned char)*e->p) || *e->p == '.') {
+		char* end;
+
+		v = strtod(e->p, &end);
+		if (end == e->p)
+			e->error = true;
+		e->p = end;
+		return v;
+	}
+
+	if (expr_accept(e, '(')) {
+		v = expr_sum(e);
+		if (!expr_accept(e, ')'))
+			e->error = true;
+		return v;
+	}
+
+	start = e->p;
+	while (isalnum((unsigned char)*e->p) || *e->p == '_')
+		e->p++;
+	len = e->p - start;
+
+	if (expr_ident(e, start, len, "SCREEN_WIDTH"))
+		return e->device->screens[0]->width;
+	if (expr_ident(e, start, len, "SCREEN_HEIGHT"))
+		return e->device->screens[0]->height;
+	if (expr_ident(e, start, len, "LOGICAL_WIDTH"))
+		return LOGICAL_WIDTH;
+	if (expr_ident(e, start, len, "LOGICAL_HEIGHT"))
+		return LOGICAL_HEIGHT;
+
+	if (expr_ident(e, start, len, "physicalw") ||
+	    expr_ident(e, start, len, "physicalh")) {
+		bool width = start[8] == 'w';
+
+		if (!expr_accept(e, '(')) {
+			e->error = true;
+			return 0;
+		}
+		v = expr_sum(e);
+		if (!expr_accept(e, ')'))
+			e->error = true;
+
+		if (width)
+			return v / LOGICAL_WIDTH * e->device->screens[0]->width;
+		return v / LOGICAL_HEIGHT * e->device->screens[0]->height;
+	}
+
+	e->error = true;
+	return 0;
+}
+
+static double expr_unary(struct expr_parser* e)
+{
+	if (expr_accept(e, '-'))
+		return -expr_unary(e);
+	return expr_primary(e);
+}
+
+static double expr_product(struct expr_parser* e)
+{
+	double v = expr_unary(e);
+
+	while (!e->error) {
+		if (expr_accept(e, '*')) {
+			v *= expr_unary(e);
+		} else if (expr_accept(e, '/')) {
+			double d;
+
+			/* Lua has integer division with // */
+			if (*e->p == '/') {
+				e->error = true;
+				break;
+			}
+
+			/* let Lua deal with infinities */
+			d = expr_unary(e);
+			if (d == 0.)
+				e->error = true;
+			else
+				v /= d;
+		} else {
+			break;
+		}
+	}
+
+	return v;
+}
+
+static double expr_sum(struct expr_parser* e)
+{
+	double v = expr_product(e);
+
+	while (!e->error) {
+		if (expr_accept(e, '+'))
+			v += expr_product(e);
+		else if (expr_accept(e, '-'))
+			v -= expr_product(e);
+		else
+			break;
+	}
+
+	return v;
+}
+
+static bool native_evaluate(const char* expr, struct kms_device* device,
+			    double* value)
+{
+	struct expr_parser e = { expr, device, false };
+
+	*value = expr_sum(&e);
+	expr_skip(&e);
+
+	return !e.error && !*e.p;
+}
+
 static int eval_expr(cJSON* val, struct kms_device* device, int default_value)
 {
 	if (cJSON_IsNumber(val))
@@ -255,37 +490,299 @@ static int eval_expr(cJSON* val, struct kms_device* device, int default_value)
 	else if (cJSON_IsString(val)) {
 		if (strncmp("0x", val->valuestring, strlen("0x")) == 0)
 			return strtol(val->valuestring, NULL, 16);
-		else
+		else {
+			double value;
+
+			if (native_evaluate(val->valuestring, device, &value))
+				return value;
+
 			return lua_evaluate(val->valuestring, device);
+		}
 	}
 	return default_value;
 }
 
 static void add_text_entry(struct plane_data* data, cJSON* t, struct kms_device* device)
 {
-	int k;
 	cJSON* text_str = cJSON_GetObjectItemCaseSensitive(t, "str");
 	cJSON* text_x = cJSON_GetObjectItemCaseSensitive(t, "x");
 	cJSON* text_y = cJSON_GetObjectItemCaseSensitive(t, "y");
 	cJSON* text_color = cJSON_GetObjectItemCaseSensitive(t, "color");
 	cJSON* text_size = cJSON_GetObjectItemCaseSensitive(t, "size");
+	uint32_t color = 0x000000ff;
 
 	if (cJSON_IsString(text_str)) {
-		for (k = 0; k < 255; k++) {
-			if (!strlen(data->text[k].str)) {
-				strncpy(data->text[k].str, text_str->valuestring, MAX_TEXT_STR_LEN-1);
-				data->text[k].x = eval_expr(text_x, device, 0);
-				data->text[k].y = eval_expr(text_y, device, 0);
-				if (cJSON_IsString(text_color))
-					data->text[k].color = strtoul(text_color->valuestring, NULL, 0);
-				else
-					data->text[k].color = 0x000000ff;
+		if (cJSON_IsString(text_color))
+			color = strtoul(text_color->valuestring, NULL, 0);
+
+		if (plane_add_text(data, text_str->valuestring,
+				   eval_expr(text_x, device, 0),
+				   eval_expr(text_y, device, 0),
+				   color, eval_expr(text_size, device, 24)))
+			LOG("error: failed to add text\n");
+	}
+}
+
+enum {
+	LIVE_X,
+	LIVE_Y,
+	LIVE_ALPHA,
+	LIVE_SCALE,
+	LIVE_ROTATE,
+	LIVE_PAN_X,
+	LIVE_PAN_Y,
+	LIVE_XSPEED,
+	LIVE_YSPEED,
+};
+
+struct
+{
+	const char* s;
+	int v;
+} live_map[] = {
+	{"x", LIVE_X},
+	{"y", LIVE_Y},
+	{"alpha", LIVE_ALPHA},
+	{"scale", LIVE_SCALE},
+	{"rotate", LIVE_ROTATE},
+	{"pan-x", LIVE_PAN_X},
+	{"pan-y", LIVE_PAN_Y},
+	{"move-xspeed", LIVE_XSPEED},
+	{"move-yspeed", LIVE_YSPEED},
+};
+
+/*
+ * Lua chunks compiled at load time and evaluated on every frame, each bound to
+ * a plane field.
+ */
+struct live_binding
+{
+	int field;
+	int cookie;
+	/* the source, kept for scenes */
+	char* expr;
+};
+
+struct live_data
+{
+	unsigned int count;
+	struct live_binding bindings[];
+};
+
+/* number of planes with live bindings, and the time they started */
+static unsigned int live_planes;
+static uint64_t live_start_ns;
+static uint32_t live_frame;
+
+static uint64_t now_ns(void);
+
+static void live_release(struct live_data* live)
+{
+	unsigned int i;
+
+	for (i = 0; i < live->count; i++) {
+		if (live->bindings[i].cookie != LUA_NOREF)
+			script_unref(live->bindings[i].cookie);
+		free(live->bindings[i].expr);
+	}
+
+	free(live);
+}
+
+static void live_free(void* data)
+{
+	live_planes--;
+	live_release(data);
+}
+
+static struct live_data* live_create(unsigned int count)
+{
+	return calloc(1, sizeof(struct live_data) +
+		      count * sizeof(struct live_binding));
+}
+
+/* compile expr and bind it to field */
+static void live_add(struct live_data* live, int field, const char* expr)
+{
+	struct live_binding* b = &live->bindings[live->count];
+	char *msg = NULL;
+
+	b->cookie = script_load(expr, &msg);
+	if (msg) {
+		LOG("can't load expr: %s\n", msg);
+		free(msg);
+		return;
+	}
+
+	b->expr = strdup(expr);
+	if (!b->expr) {
+		script_unref(b->cookie);
+		return;
+	}
+
+	b->field = field;
+	live->count++;
+}
+
+/* hand the bindings over to the plane, or free them if there are none */
+static void live_attach(struct plane_data* data, struct live_data* live)
+{
+	if (!live->count) {
+		free(live);
+		return;
+	}
+
+	if (!live_planes++) {
+		live_start_ns = now_ns();
+		live_frame = 0;
+	}
+
+	data->engine_data = live;
+	data->engine_free = live_free;
+}
+
+static void parse_live(struct plane_data* data, cJSON* live,
+		       struct kms_device* device)
+{
+	struct live_data* l;
+	cJSON* item;
+	unsigned int k;
+
+	if (!cJSON_IsObject(live) || !lua_setup(device))
+		return;
+
+	l = live_create(cJSON_GetArraySize(live));
+	if (!l)
+		return;
+
+	cJSON_ArrayForEach(item, live) {
+		if (!cJSON_IsString(item))
+			continue;
 
-				data->text[k].size = eval_expr(text_size, device, 24);
+		for (k = 0; k < ARRAY_SIZE(live_map); k++)
+			if (!strcmp(live_map[k].s, item->string))
 				break;
-			}
+
+		if (k == ARRAY_SIZE(live_map)) {
+			LOG("error: %s can't be live\n", item->string);
+			continue;
+		}
+
+		live_add(l, live_map[k].v, item->valuestring);
+	}
+
+	live_attach(data, l);
+}
+
+/*
+ * Evaluate the live bindings of a plane. Return true if the plane changed.
+ */
+/*
+ * Check a value computed for a field before it goes in the plane, which
+ * doesn't expect anything the config itself wouldn't accept.
+ */
+static bool live_valid(struct plane_data* plane, int field, double v)
+{
+	if (!isfinite(v))
+		return false;
+
+	switch (field) {
+	case LIVE_X:
+	case LIVE_Y:
+	case LIVE_XSPEED:
+	case LIVE_YSPEED:
+		return v >= INT_MIN && v <= INT_MAX;
+	case LIVE_ALPHA:
+		return v >= 0 && v <= 255;
+	case LIVE_SCALE:
+		return v > 0;
+	case LIVE_ROTATE:
+		return v == 0 || v == 90 || v == 180 || v == 270;
+	case LIVE_PAN_X:
+		return v >= 0 && v + plane->pan.width <= plane_width(plane);
+	case LIVE_PAN_Y:
+		return v >= 0 && v + plane->pan.height <= plane_height(plane);
+	}
+
+	return false;
+}
+
+static bool live_update(struct plane_data* plane)
+{
+	struct live_data* live = plane->engine_data;
+	bool changed = false;
+	unsigned int i;
+
+	for (i = 0; i < live->count; i++) {
+		struct live_binding* b = &live->bindings[i];
+		char *msg = NULL;
+		double v;
+
+		if (b->cookie == LUA_NOREF)
+			continue;
+
+		v = script_eval(b->cookie, &msg);
+		if (msg || !live_valid(plane, b->field, v)) {
+			/* don't fail again on every frame */
+			if (msg)
+				LOG("can't eval: %s\n", msg);
+			else
+				LOG("error: invalid value %g for %s\n", v,
+				    b->expr);
+			free(msg);
+			script_unref(b->cookie);
+			b->cookie = LUA_NOREF;
+			continue;
+		}
+
+		switch (b->field) {
+		case LIVE_X:
+			changed |= plane->x != (int)v;
+			plane->x = v;
+			break;
+		case LIVE_Y:
+			changed |= plane->y != (int)v;
+			plane->y = v;
+			break;
+		case LIVE_ALPHA:
+			changed |= plane->alpha != (uint32_t)v;
+			plane_set_alpha(plane, v);
+			break;
+		case LIVE_SCALE:
+			changed |= plane->scale_x != v || plane->scale_y != v;
+			plane_set_scale(plane, v);
+			break;
+		case LIVE_ROTATE:
+			changed |= plane->rotate_degrees != (int)v;
+			plane_set_rotate(plane, v);
+			break;
+		case LIVE_PAN_X:
+			changed |= plane->pan.x != (int)v;
+			plane->pan.x = v;
+			break;
+		case LIVE_PAN_Y:
+			changed |= plane->pan.y != (int)v;
+			plane->pan.y = v;
+			break;
+		case LIVE_XSPEED:
+			plane->move.xspeed = v;
+			break;
+		case LIVE_YSPEED:
+			plane->move.yspeed = v;
+			break;
 		}
 	}
+
+	return changed;
+}
+
+/*
+ * Variables the live bindings can use, set once per frame.
+ */
+static void live_frame_begin(void)
+{
+	script_setvar("frame", live_frame++);
+	script_setvar("time", (double)(now_ns() - live_start_ns) / 1000000000.);
 }
 
 static struct plane_data* parse_plane(const char* config_file,
@@ -303,6 +800,7 @@ static struct plane_data* parse_plane(const char* config_file,
 	cJSON* height = cJSON_GetObjectItemCaseSensitive(plane, "height");
 	cJSON* alpha = cJSON_GetObjectItemCaseSensitive(plane, "alpha");
 	cJSON* format = cJSON_GetObjectItemCaseSensitive(plane, "format");
+	cJSON* buffers = cJSON_GetObjectItemCaseSensitive(plane, "buffers");
 	cJSON* scale = cJSON_GetObjectItemCaseSensitive(plane, "scale");
 	cJSON* rotate = cJSON_GetObjectItemCaseSensitive(plane, "rotate");
 	cJSON* image = cJSON_GetObjectItemCaseSensitive(plane, "image");
@@ -343,6 +841,7 @@ static struct plane_data* parse_plane(const char* config_file,
 	cJSON* sprite_speed = cJSON_GetObjectItemCaseSensitive(plane, "sprite-speed");
 
 	cJSON* text = cJSON_GetObjectItemCaseSensitive(plane, "text");
+	cJSON* live = cJSON_GetObjectItemCaseSensitive(plane, "live");
 
 	if (cJSON_IsBool(enabled) && cJSON_IsFalse(enabled)) {
 		return NULL;
@@ -375,12 +874,12 @@ static struct plane_data* parse_plane(const char* config_file,
 		if (cJSON_IsNumber(index))
 			idx = index->valueint;
 
-		data = plane_create(device, DRM_PLANE_TYPE_PRIMARY, idx,
-				    eval_expr(width, device,
-					      device->screens[0]->width),
-				    eval_expr(height, device,
-					      device->screens[0]->height),
-				    f);
+		data = plane_create_buffered(device, DRM_PLANE_TYPE_PRIMARY, idx,
+					     eval_expr(width, device,
+						       device->screens[0]->width),
+					     eval_expr(height, device,
+						       device->screens[0]->height),
+					     f, eval_expr(buffers, device, 1));
 		if (!data) {
 			LOG("error: failed to create plane\n");
 			return NULL;
@@ -441,6 +940,8 @@ static struct plane_data* parse_plane(const char* config_file,
 		int idx = 0;
 		bool vgradient = false;
 		int p = 0;
+		int transform_flags = 0;
+		int buffer_count;
 
 		if (cJSON_IsString(format)) {
 			f = kms_format_val(format->valuestring);
@@ -451,18 +952,41 @@ static struct plane_data* parse_plane(const char* config_file,
 		if (cJSON_IsNumber(index))
 			idx = index->valueint;
 
-		data = plane_create(device,
-				    DRM_PLANE_TYPE_OVERLAY, idx,
-				    eval_expr(width, device,
-					      device->screens[0]->width),
-				    eval_expr(height, device,
-					      device->screens[0]->height),
-				    f);
+		for (j = 0; j < cJSON_GetArraySize(transformarray);j++) {
+			cJSON* transform = cJSON_GetArrayItem(transformarray, j);
+
+			if (cJSON_IsString(transform)) {
+				for (k = 0; k < ARRAY_SIZE(transform_map); k++) {
+					if (!strcmp(transform_map[k].s, transform->valuestring))
+						transform_flags |= transform_map[k].v;
+				}
+			}
+		}
+
+		/* prerendered flips live in a second framebuffer */
+		if (!(transform_flags & (TRANSFORM_FLIP_HORIZONTAL |
+					 TRANSFORM_FLIP_VERTICAL)))
+			transform_flags &= ~TRANSFORM_PRERENDER;
+
+		if (transform_flags & TRANSFORM_PRERENDER)
+			buffer_count = 2;
+		else
+			buffer_count = eval_expr(buffers, device, 1);
+
+		data = plane_create_buffered(device,
+					     DRM_PLANE_TYPE_OVERLAY, idx,
+					     eval_expr(width, device,
+						       device->screens[0]->width),
+					     eval_expr(height, device,
+						       device->screens[0]->height),
+					     f, buffer_count);
 		if (!data) {
 			LOG("error: failed to create plane\n");
 			return NULL;
 		}
 
+		data->transform_flags = transform_flags;
+
 		if (cJSON_IsString(name))
 			strncpy(data->name, name->valuestring, sizeof(data->name)-1);
 
@@ -561,17 +1085,6 @@ static struct plane_data* parse_plane(const char* config_file,
 			}
 		}
 
-		for (j = 0; j < cJSON_GetArraySize(transformarray);j++) {
-			cJSON* transform = cJSON_GetArrayItem(transformarray, j);
-
-			if (cJSON_IsString(transform)) {
-				for (k = 0; k < ARRAY_SIZE(transform_map); k++) {
-					if (!strcmp(transform_map[k].s, transform->valuestring))
-						data->transform_flags |= transform_map[k].v;
-				}
-			}
-		}
-
 		if (cJSON_IsArray(text)) {
 			for (j = 0; j < cJSON_GetArraySize(text);j++) {
 				cJSON* t = cJSON_GetArrayItem(text, j);
@@ -581,8 +1094,13 @@ static struct plane_data* parse_plane(const char* config_file,
 			add_text_entry(data, text, device);
 		}
 
+		parse_live(data, live, device);
+
 		configure_plane(data, colors, vgradient, p, filename, filename_raw);
 
+		if (transform_flags & TRANSFORM_PRERENDER)
+			prerender_flip(data);
+
 		if (filename)
 			free((char*)filename);
 		if (filename_raw)
@@ -608,12 +1126,12 @@ static struct plane_data* parse_plane(const char* config_file,
 		if (cJSON_IsNumber(index))
 			idx = index->valueint;
 
-		data = plane_create(device, DRM_PLANE_TYPE_CURSOR, idx,
-				    eval_expr(width, device,
-					      device->screens[0]->width),
-				    eval_expr(height, device,
-					      device->screens[0]->height),
-				    f);
+		data = plane_create_buffered(device, DRM_PLANE_TYPE_CURSOR, idx,
+					     eval_expr(width, device,
+						       device->screens[0]->width),
+					     eval_expr(height, device,
+						       device->screens[0]->height),
+					     f, eval_expr(buffers, device, 1));
 
 		if (!data) {
 			LOG("error: failed to create plane\n");
@@ -680,6 +1198,8 @@ static struct plane_data* parse_plane(const char* config_file,
 			add_text_entry(data, text, device);
 		}
 
+		parse_live(data, live, device);
+
 		configure_plane(data, colors, vgradient, p, filename, filename_raw);
 
 		if (filename)
@@ -694,9 +1214,50 @@ static struct plane_data* parse_plane(const char* config_file,
 	return data;
 }
 
-int engine_load_config(const char* config_file, struct kms_device* device,
-		       struct plane_data** planes, uint32_t num_planes,
-		       uint32_t* framedelay)
+/*
+ * Make sure the hardware can display the plane as configured, giving up on
+ * rotation and then on scaling before rejecting the plane.
+ */
+static bool admit_plane(struct plane_data* plane)
+{
+	if (!plane_check(plane))
+		return true;
+
+	if (plane->rotate_degrees ||
+	    (plane->transform_flags & (TRANSFORM_ROTATE_CLOCKWISE |
+				       TRANSFORM_ROTATE_CCLOCKWISE))) {
+		LOG("warning: plane %d:%d not supported, disabling rotation\n",
+		    plane->type, plane->index);
+		plane->rotate_degrees = 0;
+		plane->transform_flags &= ~(TRANSFORM_ROTATE_CLOCKWISE |
+					    TRANSFORM_ROTATE_CCLOCKWISE);
+		if (!plane_check(plane))
+			return true;
+	}
+
+	if (plane->scale_x != 1.0 || plane->scale_y != 1.0 ||
+	    (plane->move_flags & MOVE_SCALER)) {
+		LOG("warning: plane %d:%d not supported, disabling scaling\n",
+		    plane->type, plane->index);
+		plane_set_scale(plane, 1.0);
+		plane->move_flags &= ~MOVE_SCALER;
+		if (!plane_check(plane))
+			return true;
+	}
+
+	LOG("error: plane %d:%d configuration not supported\n",
+	    plane->type, plane->index);
+
+	return false;
+}
+
+/*
+ * Create the planes of a config file. With admission, those the hardware can't
+ * display are adjusted or dropped.
+ */
+static int parse_config(const char* config_file, struct kms_device* device,
+			struct plane_data** planes, uint32_t num_planes,
+			uint32_t* framedelay, bool admission)
 {
 	cJSON* root = load_config(config_file);
 	if (root) {
@@ -710,16 +1271,21 @@ int engine_load_config(const char* config_file, struct kms_device* device,
 		for (i = 0; i < cJSON_GetArraySize(planesarray) && itarget < (int)num_planes;i++) {
 			cJSON* plane = cJSON_GetArrayItem(planesarray, i);
 			struct plane_data* p = parse_plane(config_file, device, plane);
-			if (p)
-				planes[itarget++] = p;
-		}
+			if (!p)
+				continue;
 
-		for (i = 0; i < (int)num_planes;i++) {
-			if (planes[i])
-				plane_apply(planes[i]);
+			if (admission && !admit_plane(p)) {
+				plane_free(p);
+				continue;
+			}
+
+			planes[itarget++] = p;
 		}
 
 		cJSON_Delete(root);
+
+		/* the images are in the framebuffers now */
+		image_cache_clear();
 	} else {
 		return -1;
 	}
@@ -727,27 +1293,748 @@ int engine_load_config(const char* config_file, struct kms_device* device,
 	return 0;
 }
 
-static int mssleep(uint32_t ms)
+/*
+ * If even an empty commit is refused, the checks can't tell anything about
+ * the planes.
+ */
+static bool admission_available(struct kms_device* device)
 {
-	struct timespec req, rem;
-	req.tv_sec = (time_t)(ms / 1000);
-	req.tv_nsec = (ms - ((long)req.tv_sec * 1000L)) * 1000000L;
-	return nanosleep(&req , &rem);
+	if (kms_device_test(device)) {
+		LOG("warning: test commits not available, planes are not checked\n");
+		return false;
+	}
+
+	return true;
+}
+
+int engine_load_config(const char* config_file, struct kms_device* device,
+		       struct plane_data** planes, uint32_t num_planes,
+		       uint32_t* framedelay)
+{
+	unsigned int i;
+	int ret;
+
+	ret = parse_config(config_file, device, planes, num_planes, framedelay,
+			   admission_available(device));
+	if (ret)
+		return ret;
+
+	for (i = 0; i < num_planes; i++) {
+		if (planes[i])
+			plane_apply(planes[i]);
+	}
+
+	return 0;
+}
+
+static struct plane_data* plane_using(struct kms_plane* plane,
+				      struct plane_data** planes,
+				      uint32_t num_planes)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i] && planes[i]->plane == plane)
+			return planes[i];
+
+	return NULL;
+}
+
+static bool plane_in_use(struct kms_plane* plane, struct plane_data** planes,
+			 uint32_t num_planes)
+{
+	return plane_using(plane, planes, num_planes) != NULL;
+}
+
+/*
+ * Stage the old planes again in place of the new ones, which are freed. Their
+ * framebuffers go to the pool rather than being destroyed, as they may have
+ * reached the screen.
+ */
+static void reload_rollback(struct plane_data** planes, struct plane_data** old,
+			    uint32_t num_planes)
+{
+	struct plane_data* p;
+	unsigned int i;
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i] && !plane_in_use(planes[i]->plane, old, num_planes))
+			plane_hide(planes[i]);
+
+	for (i = 0; i < num_planes; i++) {
+		if (!old[i])
+			continue;
+
+		/* plane_apply() only stages what differs from the new plane */
+		p = plane_using(old[i]->plane, planes, num_planes);
+		if (p) {
+			old[i]->rotate_degrees_applied = p->rotate_degrees_applied;
+			old[i]->alpha_applied = p->alpha_applied;
+		}
+
+		plane_apply(old[i]);
+	}
+
+	for (i = 0; i < num_planes; i++)
+		plane_free_pooled(planes[i]);
+
+	memcpy(planes, old, num_planes * sizeof(*old));
+}
+
+int engine_reload_config(const char* config_file, struct kms_device* device,
+			 struct plane_data** planes, uint32_t num_planes,
+			 uint32_t* framedelay)
+{
+	struct plane_data** old;
+	bool admission;
+	unsigned int i;
+	int ret;
+
+	old = calloc(num_planes, sizeof(*old));
+	if (!old)
+		return -1;
+
+	memcpy(old, planes, num_planes * sizeof(*old));
+	memset(planes, 0, num_planes * sizeof(*planes));
+
+	admission = admission_available(device);
+
+	/*
+	 * New planes take the framebuffers left over by the last reload. They
+	 * are checked below, together with the old planes they replace.
+	 */
+	ret = parse_config(config_file, device, planes, num_planes, framedelay,
+			   false);
+	if (ret) {
+		memcpy(planes, old, num_planes * sizeof(*old));
+		free(old);
+		return ret;
+	}
+
+	for (i = 0; i < num_planes; i++)
+		if (old[i] && !plane_in_use(old[i]->plane, planes, num_planes))
+			plane_hide(old[i]);
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i])
+			plane_apply(planes[i]);
+
+	/*
+	 * A plane checked on its own competes with the old planes still on
+	 * screen, so check the switch as a whole. If it is refused, give up on
+	 * what each plane can't do and check again.
+	 */
+	if (admission && kms_device_test(device)) {
+		for (i = 0; i < num_planes; i++) {
+			if (!planes[i])
+				continue;
+
+			if (!admit_plane(planes[i])) {
+				ret = -1;
+				break;
+			}
+
+			plane_apply(planes[i]);
+		}
+
+		if (!ret)
+			ret = kms_device_test(device);
+		if (ret) {
+			LOG("error: %s not supported\n", config_file);
+			reload_rollback(planes, old, num_planes);
+			free(old);
+			return ret;
+		}
+	}
+
+	/* the whole switch goes in a single commit */
+	ret = kms_device_flush(device, DRM_MODE_PAGE_FLIP_EVENT);
+	if (!ret)
+		ret = kms_device_wait_flip(device, 1000);
+	if (ret) {
+		LOG("error: failed to switch to %s\n", config_file);
+		reload_rollback(planes, old, num_planes);
+		free(old);
+		return ret;
+	}
+
+	/*
+	 * The old framebuffers are off screen now. Keep them for the next
+	 * reload, in place of those this one didn't need.
+	 */
+	plane_fb_pool_clear();
+	for (i = 0; i < num_planes; i++)
+		plane_free_pooled(old[i]);
+
+	free(old);
+
+	return 0;
+}
+
+#define SCENE_MAGIC 0x4e435350 /* "PSCN" */
+#define SCENE_VERSION 1
+
+/*
+ * A scene is the state of the planes right after a config was loaded, with
+ * the content of their framebuffers in the plane format. Numbers are stored in
+ * the native byte order, scenes are meant for the device they were saved on.
+ *
+ * The file is a scene_header followed, for each plane, by a scene_plane, its
+ * live bindings as scene_live entries each followed by the expression padded
+ * to 8 bytes, and for each framebuffer a scene_buffer and the content.
+ */
+struct scene_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t screen_width;
+	uint32_t screen_height;
+	uint32_t framedelay;
+	uint32_t plane_count;
+};
+
+struct scene_plane
+{
+	char name[256];
+	int32_t type;
+	uint32_t index;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t buffer_count;
+	int32_t x;
+	int32_t y;
+	int32_t rotate_degrees;
+	uint32_t alpha;
+	double scale_x;
+	double scale_y;
+	int32_t move_flags;
+	int32_t transform_flags;
+	int32_t move[6];
+	int32_t pan[6];
+	double scaler[3];
+	int32_t sprite[8];
+	uint32_t live_count;
+	uint32_t pad;
+};
+
+struct scene_live
+{
+	uint32_t field;
+	uint32_t length;
+};
+
+struct scene_buffer
+{
+	uint32_t pitch;
+	/* 0 if the content is the same as the first framebuffer */
+	uint32_t size;
+};
+
+#define SCENE_ALIGN(x) (((x) + 7) & ~7)
+
+static int scene_write(FILE* f, const void* data, size_t size)
+{
+	static const uint8_t zero[8];
+	size_t pad = SCENE_ALIGN(size) - size;
+
+	if (fwrite(data, 1, size, f) != size ||
+	    fwrite(zero, 1, pad, f) != pad)
+		return -1;
+
+	return 0;
+}
+
+static int scene_save_plane(FILE* f, struct plane_data* plane)
+{
+	struct live_data* live = NULL;
+	struct scene_plane sp;
+	unsigned int i;
+
+	if (plane->engine_free == live_free)
+		live = plane->engine_data;
+
+	memset(&sp, 0, sizeof(sp));
+	strncpy(sp.name, plane->name, sizeof(sp.name) - 1);
+	sp.type = plane->type;
+	sp.index = plane->index;
+	sp.width = plane->fbs[0]->width;
+	sp.height = plane->fbs[0]->height;
+	sp.format = plane->fbs[0]->format;
+	sp.buffer_count = plane->buffer_count;
+	sp.x = plane->x;
+	sp.y = plane->y;
+	sp.rotate_degrees = plane->rotate_degrees;
+	sp.alpha = plane->alpha;
+	sp.scale_x = plane->scale_x;
+	sp.scale_y = plane->scale_y;
+	sp.move_flags = plane->move_flags;
+	sp.transform_flags = plane->transform_flags;
+	sp.move[0] = plane->move.xspeed;
+	sp.move[1] = plane->move.yspeed;
+	sp.move[2] = plane->move.xmin;
+	sp.move[3] = plane->move.xmax;
+	sp.move[4] = plane->move.ymin;
+	sp.move[5] = plane->move.ymax;
+	sp.pan[0] = plane->pan.x;
+	sp.pan[1] = plane->pan.y;
+	sp.pan[2] = plane->pan.width;
+	sp.pan[3] = plane->pan.height;
+	sp.pan[4] = plane->pan.xspeed;
+	sp.pan[5] = plane->pan.yspeed;
+	sp.scaler[0] = plane->scaler.max;
+	sp.scaler[1] = plane->scaler.min;
+	sp.scaler[2] = plane->scaler.speed;
+	sp.sprite[0] = plane->sprite.x;
+	sp.sprite[1] = plane->sprite.y;
+	sp.sprite[2] = plane->sprite.width;
+	sp.sprite[3] = plane->sprite.height;
+	sp.sprite[4] = plane->sprite.count;
+	sp.sprite[5] = plane->sprite.index;
+	sp.sprite[6] = plane->sprite.speed;
+	sp.sprite[7] = plane->sprite.runningspeed;
+	sp.live_count = live ? live->count : 0;
+
+	if (scene_write(f, &sp, sizeof(sp)))
+		return -1;
+
+	for (i = 0; i < sp.live_count; i++) {
+		struct scene_live sl;
+
+		sl.field = live->bindings[i].field;
+		sl.length = strlen(live->bindings[i].expr);
+
+		if (scene_write(f, &sl, sizeof(sl)) ||
+		    scene_write(f, live->bindings[i].expr, sl.length))
+			return -1;
+	}
+
+	if (plane_fb_map(plane))
+		return -1;
+
+	for (i = 0; i < plane->buffer_count; i++) {
+		struct scene_buffer sb;
+
+		sb.pitch = plane->fbs[i]->pitch;
+		sb.size = plane->fbs[i]->size;
+
+		/* buffers are most often copies of the first one */
+		if (i && !memcmp(plane->bufs[i], plane->bufs[0], sb.size))
+			sb.size = 0;
+
+		if (scene_write(f, &sb, sizeof(sb)) ||
+		    scene_write(f, plane->bufs[i], sb.size))
+			break;
+	}
+
+	plane_fb_unmap(plane);
+
+	return i == plane->buffer_count ? 0 : -1;
+}
+
+int engine_save_scene(const char* scene_file, struct kms_device* device,
+		      struct plane_data** planes, uint32_t num_planes,
+		      uint32_t framedelay)
+{
+	struct scene_header header;
+	char tmp[PATH_MAX];
+	unsigned int i;
+	FILE* f;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SCENE_MAGIC;
+	header.version = SCENE_VERSION;
+	header.screen_width = device->screens[0]->width;
+	header.screen_height = device->screens[0]->height;
+	header.framedelay = framedelay;
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i] && planes[i]->fbs[0])
+			header.plane_count++;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", scene_file, getpid());
+
+	f = fopen(tmp, "wb");
+	if (!f) {
+		LOG("error: can't open %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	if (scene_write(f, &header, sizeof(header)))
+		goto error;
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i] && planes[i]->fbs[0] &&
+		    scene_save_plane(f, planes[i]))
+			goto error;
+
+	if (fclose(f)) {
+		f = NULL;
+		goto error;
+	}
+
+	if (rename(tmp, scene_file)) {
+		LOG("error: can't write %s: %s\n", scene_file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+
+error:
+	LOG("error: can't write %s\n", tmp);
+	if (f)
+		fclose(f);
+	unlink(tmp);
+	return -1;
+}
+
+/*
+ * Take the next size bytes of the scene, or return NULL if it is too short.
+ */
+static const void* scene_read(const uint8_t** pos, const uint8_t* end,
+			      size_t size)
+{
+	const uint8_t* p = *pos;
+
+	/* sizes come from the file, check them before they can wrap */
+	if (size > (size_t)(end - p) || SCENE_ALIGN(size) > (size_t)(end - p))
+		return NULL;
+
+	*pos = p + SCENE_ALIGN(size);
+
+	return p;
+}
+
+static struct plane_data* scene_load_plane(const uint8_t** pos,
+					   const uint8_t* end,
+					   struct kms_device* device)
+{
+	struct plane_data* plane;
+	struct live_data* live = NULL;
+	const struct scene_plane* p;
+	struct scene_plane sp;
+	const void* first = NULL;
+	unsigned int i;
+
+	p = scene_read(pos, end, sizeof(sp));
+	if (!p)
+		return NULL;
+	memcpy(&sp, p, sizeof(sp));
+
+	plane = plane_create_buffered(device, sp.type, sp.index, sp.width,
+				      sp.height, sp.format, sp.buffer_count);
+	if (!plane) {
+		LOG("error: failed to create plane\n");
+		return NULL;
+	}
+
+	memcpy(plane->name, sp.name, sizeof(plane->name) - 1);
+	plane->x = sp.x;
+	plane->y = sp.y;
+	plane->rotate_degrees = sp.rotate_degrees;
+	plane->alpha = sp.alpha;
+	plane->scale_x = sp.scale_x;
+	plane->scale_y = sp.scale_y;
+	plane->move_flags = sp.move_flags;
+	plane->transform_flags = sp.transform_flags;
+	plane->move.xspeed = sp.move[0];
+	plane->move.yspeed = sp.move[1];
+	plane->move.xmin = sp.move[2];
+	plane->move.xmax = sp.move[3];
+	plane->move.ymin = sp.move[4];
+	plane->move.ymax = sp.move[5];
+	plane->pan.x = sp.pan[0];
+	plane->pan.y = sp.pan[1];
+	plane->pan.width = sp.pan[2];
+	plane->pan.height = sp.pan[3];
+	plane->pan.xspeed = sp.pan[4];
+	plane->pan.yspeed = sp.pan[5];
+	plane->scaler.max = sp.scaler[0];
+	plane->scaler.min = sp.scaler[1];
+	plane->scaler.speed = sp.scaler[2];
+	plane->sprite.x = sp.sprite[0];
+	plane->sprite.y = sp.sprite[1];
+	plane->sprite.width = sp.sprite[2];
+	plane->sprite.height = sp.sprite[3];
+	plane->sprite.count = sp.sprite[4];
+	plane->sprite.index = sp.sprite[5];
+	plane->sprite.speed = sp.sprite[6];
+	plane->sprite.runningspeed = sp.sprite[7];
+
+	if (sp.live_count) {
+		/* each binding takes at least a scene_live */
+		if (sp.live_count > (size_t)(end - *pos) / sizeof(struct scene_live) ||
+		    !lua_setup(device))
+			goto error;
+
+		live = live_create(sp.live_count);
+		if (!live)
+			goto error;
+	}
+
+	for (i = 0; i < sp.live_count; i++) {
+		const struct scene_live* sl;
+		const char* s;
+		char* expr;
+
+		sl = scene_read(pos, end, sizeof(*sl));
+		if (!sl || sl->field > LIVE_YSPEED)
+			goto error;
+		s = scene_read(pos, end, sl->length);
+		if (!s)
+			goto error;
+
+		expr = strndup(s, sl->length);
+		if (!expr)
+			goto error;
+		live_add(live, sl->field, expr);
+		free(expr);
+	}
+
+	if (live) {
+		live_attach(plane, live);
+		live = NULL;
+	}
+
+	if (plane_fb_map(plane))
+		goto error;
+
+	for (i = 0; i < sp.buffer_count; i++) {
+		struct kms_framebuffer* fb = plane->fbs[i];
+		const struct scene_buffer* sb;
+		const void* data;
+
+		sb = scene_read(pos, end, sizeof(*sb));
+		if (!sb)
+			goto error;
+
+		if (sb->pitch != fb->pitch ||
+		    (sb->size && sb->size != fb->size) || (!sb->size && !i)) {
+			LOG("error: scene framebuffers don't match the device\n");
+			goto error;
+		}
+
+		if (sb->size) {
+			data = scene_read(pos, end, sb->size);
+			if (!data)
+				goto error;
+		} else {
+			data = first;
+		}
+
+		if (!i)
+			first = data;
+
+		memcpy(plane->bufs[i], data, fb->size);
+		plane_fb_damage(plane, i, 0, 0, fb->width, fb->height);
+	}
+
+	plane_fb_unmap(plane);
+
+	return plane;
+
+error:
+	/* not attached yet, the plane doesn't know about it */
+	if (live)
+		live_release(live);
+	plane_free(plane);
+	return NULL;
+}
+
+int engine_load_scene(const char* scene_file, struct kms_device* device,
+		      struct plane_data** planes, uint32_t num_planes,
+		      uint32_t* framedelay)
+{
+	const struct scene_header* header;
+	const uint8_t* pos;
+	const uint8_t* end;
+	struct stat st;
+	void* map;
+	unsigned int i;
+	int ret = -1;
+	int fd;
+
+	fd = open(scene_file, O_RDONLY);
+	if (fd < 0) {
+		LOG("error: can't open %s: %s\n", scene_file, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	pos = map;
+	end = pos + st.st_size;
+
+	header = scene_read(&pos, end, sizeof(*header));
+	if (!header || header->magic != SCENE_MAGIC ||
+	    header->version != SCENE_VERSION) {
+		LOG("error: %s is not a scene\n", scene_file);
+		goto done;
+	}
+
+	/* expressions were evaluated for this screen */
+	if (header->screen_width != device->screens[0]->width ||
+	    header->screen_height != device->screens[0]->height) {
+		LOG("error: scene made for a %ux%u screen\n",
+		    header->screen_width, header->screen_height);
+		goto done;
+	}
+
+	*framedelay = header->framedelay;
+
+	for (i = 0; i < header->plane_count && i < num_planes; i++) {
+		planes[i] = scene_load_plane(&pos, end, device);
+		if (!planes[i]) {
+			LOG("error: %s is corrupted\n", scene_file);
+			goto done;
+		}
+	}
+
+	for (i = 0; i < num_planes; i++)
+		if (planes[i])
+			plane_apply(planes[i]);
+
+	ret = 0;
+done:
+	munmap(map, st.st_size);
+	return ret;
+}
+
+static int mssleep(uint32_t ms)
+{
+	struct timespec req, rem;
+	req.tv_sec = (time_t)(ms / 1000);
+	req.tv_nsec = (ms - ((long)req.tv_sec * 1000L)) * 1000000L;
+	return nanosleep(&req , &rem);
 }
 
 #define NSEC_PER_SEC 1000000000L
 #define timerdiff(a,b) (((a)->tv_sec - (b)->tv_sec) * NSEC_PER_SEC + \
 			(((a)->tv_nsec - (b)->tv_nsec)))
 
-void engine_run_once(struct kms_device* device, struct plane_data** planes,
-		     uint32_t num_planes, uint32_t framedelay)
+static struct engine_stats stats;
+
+static uint64_t now_ns(void)
 {
-	unsigned int i;
-	struct timespec start;
 	struct timespec now;
-	unsigned long delta;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+/* account for a new frame starting at start */
+static void engine_stats_frame(uint64_t start)
+{
+	if (stats.frames++) {
+		uint64_t interval = (start - stats.last_start_ns) / 1000000;
+
+		if (interval >= ENGINE_STATS_BUCKETS)
+			interval = ENGINE_STATS_BUCKETS - 1;
+		stats.intervals[interval]++;
+	}
+
+	stats.last_start_ns = start;
+}
+
+/* account for the end of a frame started at start */
+static void engine_stats_frame_done(uint64_t start, bool missed)
+{
+	uint64_t duration = now_ns() - start;
+
+	if (duration > stats.max_frame_ns)
+		stats.max_frame_ns = duration;
+
+	if (missed)
+		stats.missed_deadlines++;
+}
+
+/* flush and account for the commit */
+static int engine_flush(struct kms_device* device, uint32_t flags)
+{
+	uint64_t start = now_ns();
+	int ret;
+
+	ret = kms_device_flush(device, flags);
+
+	/* the request is built inside the flush */
+	stats.build_ns += device->build_ns;
+	stats.commit_ns += now_ns() - start - device->build_ns;
+	if (ret)
+		stats.commit_errors++;
+
+	return ret;
+}
+
+void engine_stats_get(struct engine_stats* out)
+{
+	*out = stats;
+}
+
+void engine_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void engine_stats_dump(void)
+{
+	unsigned int i;
+
+	printf("Frames: %llu\n", (unsigned long long)stats.frames);
+	if (!stats.frames)
+		return;
+
+	printf("Average time per frame (us):\n");
+	printf("  update: %llu\n",
+	       (unsigned long long)(stats.update_ns / stats.frames / 1000));
+	printf("  transform: %llu\n",
+	       (unsigned long long)(stats.transform_ns / stats.frames / 1000));
+	printf("  stage: %llu\n",
+	       (unsigned long long)(stats.stage_ns / stats.frames / 1000));
+	printf("  build: %llu\n",
+	       (unsigned long long)(stats.build_ns / stats.frames / 1000));
+	printf("  commit: %llu\n",
+	       (unsigned long long)(stats.commit_ns / stats.frames / 1000));
+	printf("Longest frame (us): %llu\n",
+	       (unsigned long long)(stats.max_frame_ns / 1000));
+	printf("Missed deadlines: %u\n", stats.missed_deadlines);
+	printf("Commit errors: %u\n", stats.commit_errors);
+	printf("Frame intervals (ms):\n");
+	for (i = 0; i < ENGINE_STATS_BUCKETS; i++) {
+		if (!stats.intervals[i])
+			continue;
+
+		if (i == ENGINE_STATS_BUCKETS - 1)
+			printf("  >=%u: %u\n", i, stats.intervals[i]);
+		else
+			printf("  %u: %u\n", i, stats.intervals[i]);
+	}
+}
+
+/*
+ * Advance the state of every plane by one frame and stage the changes. Nothing
+ * is committed here.
+ */
+static void engine_update(struct kms_device* device, struct plane_data** planes,
+			  uint32_t num_planes)
+{
+	uint64_t start = now_ns();
+	uint64_t transform_ns = 0;
+	uint64_t stage_ns = 0;
+	uint64_t t;
+	unsigned int i;
+
+	if (live_planes)
+		live_frame_begin();
 
 	for (i = 0; i < num_planes;i++) {
 		bool trigger = false;
@@ -758,6 +2045,9 @@ void engine_run_once(struct kms_device* device, struct plane_data** planes,
 		     planes[i]->plane->type != DRM_PLANE_TYPE_CURSOR))
 			continue;
 
+		if (planes[i]->engine_free == live_free)
+			move = live_update(planes[i]);
+
 		if (planes[i]->move_flags & MOVE_X_WARP) {
 			if (planes[i]->sprite.count){
 				if ((planes[i]->x + planes[i]->sprite.width >=
@@ -959,11 +2249,16 @@ void engine_run_once(struct kms_device* device, struct plane_data** planes,
 		}
 
 		if (trigger) {
-			if (planes[i]->transform_flags & TRANSFORM_FLIP_HORIZONTAL) {
-				flip_fb_horizontal(planes[i]->fbs[0]);
-			}
-			if (planes[i]->transform_flags & TRANSFORM_FLIP_VERTICAL) {
-				flip_fb_vertical(planes[i]->fbs[0]);
+			if (planes[i]->transform_flags &
+			    (TRANSFORM_FLIP_HORIZONTAL | TRANSFORM_FLIP_VERTICAL)) {
+				t = now_ns();
+				if (planes[i]->transform_flags & TRANSFORM_PRERENDER)
+					plane_flip(planes[i], planes[i]->front_buf ^ 1);
+				else
+					flip_plane(planes[i],
+						   planes[i]->transform_flags & TRANSFORM_FLIP_HORIZONTAL,
+						   planes[i]->transform_flags & TRANSFORM_FLIP_VERTICAL);
+				transform_ns += now_ns() - t;
 			}
 
 			if (planes[i]->transform_flags & TRANSFORM_ROTATE_CLOCKWISE) {
@@ -986,15 +2281,38 @@ void engine_run_once(struct kms_device* device, struct plane_data** planes,
 		}
 
 		if (move) {
+			t = now_ns();
 			plane_apply(planes[i]);
+			stage_ns += now_ns() - t;
 		}
 	}
-	kms_device_flush(device, 0);
+
+	stats.update_ns += now_ns() - start - transform_ns - stage_ns;
+	stats.transform_ns += transform_ns;
+	stats.stage_ns += stage_ns;
+}
+
+void engine_run_once(struct kms_device* device, struct plane_data** planes,
+		     uint32_t num_planes, uint32_t framedelay)
+{
+	struct timespec start;
+	struct timespec now;
+	unsigned long delta;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	engine_stats_frame((uint64_t)start.tv_sec * NSEC_PER_SEC + start.tv_nsec);
+
+	engine_update(device, planes, num_planes);
+
+	engine_flush(device, 0);
 
 	// only delay the delta if all the work we did took lss than the framedelay
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	delta = timerdiff(&now, &start) / 1000000;
 
+	engine_stats_frame_done((uint64_t)start.tv_sec * NSEC_PER_SEC + start.tv_nsec,
+				delta > framedelay);
+
 	if (delta < framedelay)
 		mssleep(framedelay - delta);
 }
@@ -1012,6 +2330,68 @@ void engine_run(struct kms_device* device, struct plane_data** planes,
 	}
 }
 
+void engine_run_once_vsync(struct kms_device* device, struct plane_data** planes,
+			   uint32_t num_planes, uint32_t vblank_divisor)
+{
+	uint64_t start = now_ns();
+	unsigned int expected;
+	bool late;
+
+	if (!vblank_divisor)
+		vblank_divisor = 1;
+
+	engine_stats_frame(start);
+
+	engine_update(device, planes, num_planes);
+
+	/* the commit should be latched on the vblank following the last one */
+	expected = device->vblank_sequence + 1;
+
+	if (engine_flush(device, DRM_MODE_PAGE_FLIP_EVENT)) {
+		engine_stats_frame_done(start, true);
+		/* nothing to wait for, still keep the pace */
+		kms_device_wait_vblank(device, device->vblank_sequence + vblank_divisor);
+		return;
+	}
+
+	if (kms_device_wait_flip(device, 1000)) {
+		engine_stats_frame_done(start, true);
+		return;
+	}
+
+	late = (int)(device->vblank_sequence - expected) > 0;
+	engine_stats_frame_done(start, late);
+
+	if (late)
+		LOG("engine: frame late by %d vblank(s)\n",
+		    (int)(device->vblank_sequence - expected));
+
+	/*
+	 * The frame is on screen since vblank_sequence. To have the next one
+	 * latched vblank_divisor vblanks later, hold off building it until the
+	 * vblank just before.
+	 */
+	if (vblank_divisor > 1)
+		kms_device_wait_vblank(device, device->vblank_sequence + vblank_divisor - 1);
+}
+
+void engine_run_vsync(struct kms_device* device, struct plane_data** planes,
+		      uint32_t num_planes, uint32_t vblank_divisor,
+		      uint32_t max_frames)
+{
+	uint32_t frame_count = 0;
+
+	/* start from a known vblank */
+	kms_device_wait_vblank(device, 0);
+
+	while (1) {
+		engine_run_once_vsync(device, planes, num_planes, vblank_divisor);
+
+		if (max_frames && ++frame_count >= max_frames)
+			break;
+	}
+}
+
 void parse_color(uint32_t in, struct rgba_color* color)
 {
 	color->r = (double)((in >> 24) & 0xff) / 255.;
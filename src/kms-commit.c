@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2026 Microchip Technology Inc.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <xf86drm.h>
+
+#include "common.h"
+#include "p_kms.h"
+
+/* number of times a commit is sent again when the kernel is busy */
+#define COMMIT_RETRIES 3
+
+struct kms_commit_worker {
+	struct kms_device *device;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* signalled whenever a frame is done */
+	pthread_cond_t retired;
+	bool stop;
+
+	/* last frame queued and last frame reported, protected by lock */
+	unsigned int queued;
+	unsigned int done;
+
+	kms_commit_cb callback;
+	void *user_data;
+};
+
+/*
+ * Commit everything staged so far and wait for it to be on screen. Frames
+ * queued in the meantime are coalesced into the next commit.
+ */
+static int kms_commit_frame(struct kms_device *device)
+{
+	unsigned int tries;
+	int ret;
+
+	for (tries = 0; ; tries++) {
+		ret = kms_device_flush(device, DRM_MODE_PAGE_FLIP_EVENT);
+		if (ret != -EBUSY || tries == COMMIT_RETRIES)
+			break;
+
+		/* a commit sent by someone else is still pending */
+		if (__atomic_load_n(&device->flip_pending, __ATOMIC_ACQUIRE))
+			kms_device_wait_flip(device, 1000);
+		else
+			kms_device_wait_vblank(device, 0);
+	}
+
+	if (ret)
+		return ret;
+
+	return kms_device_wait_flip(device, 1000);
+}
+
+static void *kms_commit_thread(void *arg)
+{
+	struct kms_commit_worker *worker = arg;
+	unsigned int frame, last;
+	int ret;
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (1) {
+		while (!worker->stop && worker->queued == worker->done)
+			pthread_cond_wait(&worker->cond, &worker->lock);
+
+		if (worker->stop)
+			break;
+
+		last = worker->queued;
+		pthread_mutex_unlock(&worker->lock);
+
+		ret = kms_commit_frame(worker->device);
+
+		if (worker->callback)
+			for (frame = worker->done + 1; frame != last + 1; frame++)
+				worker->callback(worker->device, frame, ret,
+						 worker->user_data);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->done = last;
+		pthread_cond_broadcast(&worker->retired);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+int kms_device_start_commit_thread(struct kms_device *device,
+				   kms_commit_cb callback, void *user_data)
+{
+	struct kms_commit_worker *worker;
+	pthread_condattr_t attr;
+	int ret;
+
+	if (!device)
+		return -EINVAL;
+
+	if (device->commit_worker)
+		return -EBUSY;
+
+	worker = calloc(1, sizeof(*worker));
+	if (!worker)
+		return -ENOMEM;
+
+	worker->device = device;
+	worker->callback = callback;
+	worker->user_data = user_data;
+
+	if (pthread_mutex_init(&worker->lock, NULL)) {
+		LOG("error: can't initialize the mutex\n");
+		free(worker);
+		return -ENOMEM;
+	}
+
+	if (pthread_cond_init(&worker->cond, NULL)) {
+		LOG("error: can't initialize the condition\n");
+		pthread_mutex_destroy(&worker->lock);
+		free(worker);
+		return -ENOMEM;
+	}
+
+	/* the timeouts of kms_commit_wait_retired() are monotonic */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	ret = pthread_cond_init(&worker->retired, &attr);
+	pthread_condattr_destroy(&attr);
+	if (ret) {
+		LOG("error: can't initialize the condition\n");
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+		free(worker);
+		return -ENOMEM;
+	}
+
+	ret = pthread_create(&worker->thread, NULL, kms_commit_thread, worker);
+	if (ret) {
+		LOG("error: can't create the commit thread: %s\n", strerror(ret));
+		pthread_cond_destroy(&worker->retired);
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+		free(worker);
+		return -ret;
+	}
+
+	device->commit_worker = worker;
+
+	return 0;
+}
+
+void kms_device_stop_commit_thread(struct kms_device *device)
+{
+	struct kms_commit_worker *worker = device->commit_worker;
+
+	if (!worker)
+		return;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->stop = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_join(worker->thread, NULL);
+
+	pthread_cond_destroy(&worker->retired);
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	free(worker);
+
+	device->commit_worker = NULL;
+}
+
+int kms_device_queue_commit(struct kms_device *device, unsigned int *frame)
+{
+	struct kms_commit_worker *worker = device->commit_worker;
+	int ret;
+
+	if (!worker)
+		return -EINVAL;
+
+	ret = pthread_mutex_lock(&worker->lock);
+	if (ret) {
+		LOG("error: pthread_mutex_lock failed\n");
+		return -ret;
+	}
+
+	worker->queued++;
+
+	if (frame)
+		*frame = worker->queued;
+
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	return 0;
+}
+
+/*
+ * Wait until the commit thread moves retired_seq away from retired. Returns
+ * -EBUSY when it is idle, as nothing would be retired then.
+ */
+int kms_commit_wait_retired(struct kms_device *device, unsigned int retired,
+			    int timeout_ms)
+{
+	struct kms_commit_worker *worker = device->commit_worker;
+	struct timespec deadline;
+	int ret = 0;
+
+	if (!worker)
+		return -EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (__atomic_load_n(&device->retired_seq, __ATOMIC_ACQUIRE) == retired) {
+		if (worker->queued == worker->done) {
+			ret = -EBUSY;
+			break;
+		}
+
+		ret = pthread_cond_timedwait(&worker->retired, &worker->lock,
+					     &deadline);
+		if (ret == ETIMEDOUT) {
+			LOG("error: timeout waiting for the commit thread\n");
+			ret = -ETIMEDOUT;
+			break;
+		}
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return ret;
+}
@@ -26,9 +26,11 @@
 #endif
 
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <drm_fourcc.h>
 #include <sys/ioctl.h>
@@ -235,9 +237,13 @@ void kms_device_close(struct kms_device *device)
 {
 	unsigned int i;
 
+	kms_device_stop_commit_thread(device);
+
 	if (device->atomic_request)
 		drmModeAtomicFree(device->atomic_request);
 
+	free(device->test_cache);
+
 	for (i = 0; i < device->num_planes; i++)
 		kms_plane_free(device->planes[i]);
 
@@ -261,6 +267,26 @@ void kms_device_close(struct kms_device *device)
 	free(device);
 }
 
+/*
+ * Make every object send all its properties again on the next update, after a
+ * request that didn't reach the kernel.
+ */
+void kms_device_invalidate_state(struct kms_device *device)
+{
+	unsigned int i;
+
+	for (i = 0; i < device->num_planes; i++) {
+		drm_obj_invalidate_props(device->planes[i]->drm_obj, ~0u);
+		device->planes[i]->state->resync = true;
+	}
+
+	for (i = 0; i < device->num_crtcs; i++)
+		drm_obj_invalidate_props(device->crtcs[i]->drm_obj, ~0u);
+
+	for (i = 0; i < device->num_screens; i++)
+		drm_obj_invalidate_props(device->screens[i]->drm_obj, ~0u);
+}
+
 struct kms_plane *kms_device_find_plane_by_type(struct kms_device *device,
 						uint32_t type,
 						unsigned int index)
@@ -634,18 +660,104 @@ void kms_device_dump(struct kms_device *device)
 }
 
 /*
- * The flags parameter is not used right now. In the future it should
- * allow to choose blocking or non blocking.
+ * Add the properties needed to light up the first screen to req. On success,
+ * the caller must destroy the mode blob once the request has been committed.
+ */
+static int kms_device_add_modeset(struct kms_device *dev, drmModeAtomicReq *req,
+				  uint32_t *mode_blob_id)
+{
+	struct drm_object *connector = dev->screens[0]->drm_obj;
+	struct drm_object *crtc = dev->crtcs[0]->drm_obj;
+	drmModeModeInfo mode = dev->screens[0]->mode;
+	int ret;
+
+	ret = drmModeCreatePropertyBlob(dev->fd, &mode, sizeof(mode), mode_blob_id);
+	if (ret) {
+		LOG("error: couldn't create a blob property\n");
+		return ret;
+	}
+
+	ret = drm_obj_set_prop(req, connector, DRM_OBJ_PROP_CRTC_ID, dev->crtcs[0]->id);
+	if (ret) {
+		LOG("error: can't set CRTC_ID property\n");
+		goto error;
+	}
+
+	ret = drm_obj_set_prop(req, crtc, DRM_OBJ_PROP_MODE_ID, *mode_blob_id);
+	if (ret) {
+		LOG("error: can't set MODE_ID property\n");
+		goto error;
+	}
+
+	ret = drm_obj_set_prop(req, crtc, DRM_OBJ_PROP_ACTIVE, 1);
+	if (ret) {
+		LOG("error: can't set ACTIVE property\n");
+		goto error;
+	}
+
+	return 0;
+
+error:
+	drmModeDestroyPropertyBlob(dev->fd, *mode_blob_id);
+	return ret;
+}
+
+/*
+ * Gather the state published by plane producers. Called with req_lock held.
+ */
+static int kms_device_add_pending(struct kms_device *dev,
+				  drmModeAtomicReq *req, bool test)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < dev->num_planes; i++) {
+		ret = kms_plane_add_pending(dev->planes[i], req, test);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static uint64_t kms_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*
+ * Only DRM_MODE_PAGE_FLIP_EVENT is accepted in flags, the commit is always non
+ * blocking.
  */
 int kms_device_flush(struct kms_device *dev, uint32_t flags)
+{
+	return kms_device_flush_fence(dev, flags, NULL);
+}
+
+int kms_device_flush_fence(struct kms_device *dev, uint32_t flags,
+			   int *out_fence)
 {
 	uint32_t commit_flags = DRM_MODE_ATOMIC_NONBLOCK;
 	uint32_t mode_blob_id;
+	int32_t fence_fd = -1;
+	uint64_t start;
+	bool need_commit;
+	unsigned int i;
 	int ret = 0, mutex_ret;
 
 	if (!dev)
 		return -EINVAL;
 
+	if (out_fence)
+		*out_fence = -1;
+
+	/* an event or a fence needs a commit, even without state change */
+	need_commit = (flags & DRM_MODE_PAGE_FLIP_EVENT) || out_fence;
+
 	// Lock needed to prevent changes of a request while sending it, or the other way around.
 	mutex_ret = pthread_mutex_lock(&dev->req_lock);
 	if (mutex_ret) {
@@ -653,46 +765,87 @@ int kms_device_flush(struct kms_device *dev, uint32_t flags)
 		return mutex_ret;
 	}
 
-	if (!dev->atomic_request)
-		goto out; // Discard flush requests without any state change.
-
-	if (dev->modeset_needed) {
-		struct drm_object *connector = dev->screens[0]->drm_obj;
-		struct drm_object *crtc = dev->crtcs[0]->drm_obj;
-		drmModeModeInfo mode = dev->screens[0]->mode;
+	dev->build_ns = 0;
+	start = kms_now_ns();
 
-		ret = drmModeCreatePropertyBlob(dev->fd, &mode, sizeof(mode), &mode_blob_id);
-		if (ret) {
-			LOG("error: couldn't create a blob property\n");
+	if (!dev->atomic_request) {
+		dev->atomic_request = drmModeAtomicAlloc();
+		if (!dev->atomic_request) {
+			LOG("error: drmModeAtomicAlloc failed\n");
+			ret = -ENOMEM;
 			goto out;
 		}
+	}
 
-		ret = drm_obj_set_property(dev->atomic_request, connector, "CRTC_ID", dev->crtcs[0]->id);
-		if (ret) {
-			LOG("error: can't set CRTC_ID property\n");
-			goto modeset_prop_error;
-		}
+	ret = kms_device_add_pending(dev, dev->atomic_request, false);
+	if (ret) {
+		kms_device_invalidate_state(dev);
+		goto free_request;
+	}
 
-		ret = drm_obj_set_property(dev->atomic_request, crtc, "MODE_ID", mode_blob_id);
+	/*
+	 * Planes only add the properties that changed, so there might be
+	 * nothing to commit.
+	 */
+	if (!dev->modeset_needed && !need_commit &&
+	    !drmModeAtomicGetCursor(dev->atomic_request)) {
+		dev->build_ns = kms_now_ns() - start;
+		goto free_request;
+	}
+
+	if (dev->modeset_needed) {
+		ret = kms_device_add_modeset(dev, dev->atomic_request, &mode_blob_id);
 		if (ret) {
-			LOG("error: can't set MODE_ID property\n");
-			goto modeset_prop_error;
+			kms_device_invalidate_state(dev);
+			goto free_request;
 		}
 
-		ret = drm_obj_set_property(dev->atomic_request, crtc, "ACTIVE", 1);
+		commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	} else if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+		/*
+		 * The event is only sent for CRTCs that are part of the
+		 * commit. Pull the CRTC in, so a frame without any plane
+		 * change is still paced on the vblank.
+		 */
+		ret = drm_obj_set_prop(dev->atomic_request, dev->crtcs[0]->drm_obj, DRM_OBJ_PROP_ACTIVE, 1);
 		if (ret) {
 			LOG("error: can't set ACTIVE property\n");
-			goto modeset_prop_error;
+			kms_device_invalidate_state(dev);
+			goto free_request;
 		}
+	}
 
-		commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	if (out_fence) {
+		/* the kernel writes the sync file fd to fence_fd during the commit */
+		ret = drm_obj_set_prop(dev->atomic_request, dev->crtcs[0]->drm_obj,
+				       DRM_OBJ_PROP_OUT_FENCE_PTR,
+				       (uint64_t)(uintptr_t)&fence_fd);
+		if (ret) {
+			LOG("error: can't set OUT_FENCE_PTR property\n");
+			kms_device_invalidate_state(dev);
+			goto destroy_blob;
+		}
 	}
 
-	ret = drmModeAtomicCommit(dev->fd, dev->atomic_request, commit_flags, NULL);
-	if (ret)
+	if (flags & DRM_MODE_PAGE_FLIP_EVENT)
+		commit_flags |= DRM_MODE_PAGE_FLIP_EVENT;
+
+	dev->build_ns = kms_now_ns() - start;
+
+	ret = drmModeAtomicCommit(dev->fd, dev->atomic_request, commit_flags, dev);
+	if (ret) {
 		LOG("error: drmModeAtomicCommit failed: %d\n", ret);
+		kms_device_invalidate_state(dev);
+	} else {
+		__atomic_store_n(&dev->commit_seq, dev->commit_seq + 1,
+				 __ATOMIC_RELEASE);
+		if (commit_flags & DRM_MODE_PAGE_FLIP_EVENT)
+			__atomic_store_n(&dev->flip_pending, true, __ATOMIC_RELEASE);
+		if (out_fence)
+			*out_fence = fence_fd;
+	}
 
-modeset_prop_error:
+destroy_blob:
 
 	if (dev->modeset_needed) {
 		drmModeDestroyPropertyBlob(dev->fd, mode_blob_id);
@@ -700,6 +853,10 @@ modeset_prop_error:
 			dev->modeset_needed = false;
 	}
 
+free_request:
+	for (i = 0; i < dev->num_planes; i++)
+		kms_plane_end_commit(dev->planes[i], !ret);
+
 	drmModeAtomicFree(dev->atomic_request);
 	dev->atomic_request = NULL;
 
@@ -712,3 +869,256 @@ out:
 
 	return ret;
 }
+
+/*
+ * Check req with a test only commit, on top of the modeset if it hasn't been
+ * done yet. req itself is left untouched.
+ */
+int kms_device_test_request(struct kms_device *dev, drmModeAtomicReq *req)
+{
+	uint32_t commit_flags = DRM_MODE_ATOMIC_TEST_ONLY;
+	uint32_t mode_blob_id;
+	drmModeAtomicReq *test;
+	int ret;
+
+	test = req ? drmModeAtomicDuplicate(req) : drmModeAtomicAlloc();
+	if (!test)
+		return -ENOMEM;
+
+	if (dev->modeset_needed) {
+		ret = kms_device_add_modeset(dev, test, &mode_blob_id);
+		if (ret)
+			goto out;
+
+		commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	ret = drmModeAtomicCommit(dev->fd, test, commit_flags, NULL);
+	if (ret)
+		LOG("test commit rejected: %d\n", ret);
+
+	if (dev->modeset_needed)
+		drmModeDestroyPropertyBlob(dev->fd, mode_blob_id);
+
+out:
+	drmModeAtomicFree(test);
+
+	return ret;
+}
+
+int kms_device_test(struct kms_device *dev)
+{
+	drmModeAtomicReq *req;
+	int ret, mutex_ret;
+
+	if (!dev)
+		return -EINVAL;
+
+	mutex_ret = pthread_mutex_lock(&dev->req_lock);
+	if (mutex_ret) {
+		LOG("error: pthread_mutex_lock failed\n");
+		return mutex_ret;
+	}
+
+	req = dev->atomic_request ? drmModeAtomicDuplicate(dev->atomic_request) :
+		drmModeAtomicAlloc();
+	if (!req) {
+		ret = -ENOMEM;
+	} else {
+		ret = kms_device_add_pending(dev, req, true);
+		if (!ret)
+			ret = kms_device_test_request(dev, req);
+		drmModeAtomicFree(req);
+	}
+
+	mutex_ret = pthread_mutex_unlock(&dev->req_lock);
+	if (mutex_ret) {
+		LOG("error: pthread_mutex_unlock failed\n");
+		ret = mutex_ret;
+	}
+
+	return ret;
+}
+
+#define TEST_CACHE_SIZE 64
+
+struct kms_test_entry {
+	uint64_t key;
+	int result;
+};
+
+/* FNV-1a */
+uint64_t kms_config_hash(const uint32_t *config, size_t count)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		hash ^= config[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	/* zero marks an empty cache entry */
+	return hash ? hash : 1;
+}
+
+bool kms_device_test_lookup(struct kms_device *device, uint64_t key, int *result)
+{
+	struct kms_test_entry *entry;
+
+	if (!device->test_cache)
+		return false;
+
+	entry = &device->test_cache[key % TEST_CACHE_SIZE];
+	if (entry->key != key)
+		return false;
+
+	*result = entry->result;
+
+	return true;
+}
+
+void kms_device_test_store(struct kms_device *device, uint64_t key, int result)
+{
+	struct kms_test_entry *entry;
+
+	/* only remember what the kernel said */
+	if (result == -ENOMEM)
+		return;
+
+	if (!device->test_cache) {
+		device->test_cache = calloc(TEST_CACHE_SIZE, sizeof(*device->test_cache));
+		if (!device->test_cache)
+			return;
+	}
+
+	entry = &device->test_cache[key % TEST_CACHE_SIZE];
+	entry->key = key;
+	entry->result = result;
+}
+
+static void page_flip_handler(int fd, unsigned int sequence,
+			      unsigned int tv_sec, unsigned int tv_usec,
+			      void *user_data)
+{
+	struct kms_device *device = user_data;
+
+	device->vblank_sequence = sequence;
+	device->vblank_time_ns = (uint64_t)tv_sec * 1000000000ULL +
+		(uint64_t)tv_usec * 1000ULL;
+	__atomic_store_n(&device->flip_pending, false, __ATOMIC_RELEASE);
+	/* commits are latched in order, everything sent so far is done */
+	__atomic_store_n(&device->retired_seq,
+			 __atomic_load_n(&device->commit_seq, __ATOMIC_ACQUIRE),
+			 __ATOMIC_RELEASE);
+}
+
+int kms_device_wait_flip(struct kms_device *device, int timeout_ms)
+{
+	drmEventContext evctx;
+	struct pollfd pfd;
+	int ret;
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = 2;
+	evctx.page_flip_handler = page_flip_handler;
+
+	pfd.fd = device->fd;
+	pfd.events = POLLIN;
+
+	while (__atomic_load_n(&device->flip_pending, __ATOMIC_ACQUIRE)) {
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (!ret) {
+			LOG("error: timeout waiting for page flip event\n");
+			return -ETIMEDOUT;
+		}
+
+		ret = drmHandleEvent(device->fd, &evctx);
+		if (ret) {
+			LOG("error: drmHandleEvent failed: %d\n", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int kms_fence_wait(int fence_fd, int timeout_ms)
+{
+	struct pollfd pfd;
+	int ret;
+
+	if (fence_fd < 0)
+		return -EINVAL;
+
+	pfd.fd = fence_fd;
+	pfd.events = POLLIN;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0)
+		return -errno;
+	if (!ret)
+		return -ETIMEDOUT;
+	if (pfd.revents & (POLLERR | POLLNVAL))
+		return -EINVAL;
+
+	return 0;
+}
+
+int kms_device_wait_idle(struct kms_device *device, int timeout_ms)
+{
+	int ret;
+
+	if (__atomic_load_n(&device->flip_pending, __ATOMIC_ACQUIRE)) {
+		ret = kms_device_wait_flip(device, timeout_ms);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * Commits sent without an event don't report their completion. A non
+	 * blocking commit is latched by the vblank after it has been sent at
+	 * worst, so wait until a full frame has gone by.
+	 */
+	if (device->retired_seq != device->commit_seq) {
+		ret = kms_device_wait_vblank(device, 0);
+		if (!ret)
+			ret = kms_device_wait_vblank(device, device->vblank_sequence + 1);
+		if (ret)
+			return ret;
+
+		__atomic_store_n(&device->retired_seq, device->commit_seq,
+				 __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+int kms_device_wait_vblank(struct kms_device *device, unsigned int sequence)
+{
+	drmVBlank vbl;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_ABSOLUTE | DRM_VBLANK_NEXTONMISS;
+	vbl.request.sequence = sequence;
+
+	if (drmWaitVBlank(device->fd, &vbl)) {
+		LOG("error: drmWaitVBlank failed: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	device->vblank_sequence = vbl.reply.sequence;
+	device->vblank_time_ns = (uint64_t)vbl.reply.tval_sec * 1000000000ULL +
+		(uint64_t)vbl.reply.tval_usec * 1000ULL;
+
+	return 0;
+}
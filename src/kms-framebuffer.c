@@ -78,6 +78,7 @@ struct kms_framebuffer *kms_framebuffer_create(struct kms_device *device,
 	fb->width = width;
 	fb->height = height;
 	fb->format = format;
+	fb->map_persistent = true;
 	fb->prime_fd = -1;
 
 	memset(&args, 0, sizeof(args));
@@ -190,6 +191,8 @@ void kms_framebuffer_free(struct kms_framebuffer *fb)
 	struct drm_mode_destroy_dumb args;
 	int err;
 
+	kms_framebuffer_release_mapping(fb);
+
 	if (fb->id) {
 		err = drmModeRmFB(device->fd, fb->id);
 		if (err < 0) {
@@ -209,6 +212,11 @@ void kms_framebuffer_free(struct kms_framebuffer *fb)
 	free(fb);
 }
 
+/*
+ * Mappings are reference counted. The first user maps the framebuffer, the
+ * others get the same pointer without any syscall. Unless the framebuffer is in
+ * persistent mode, the mapping is released along with the last user.
+ */
 int kms_framebuffer_map(struct kms_framebuffer *fb, void **ptrp)
 {
 	struct kms_device *device = fb->device;
@@ -217,6 +225,7 @@ int kms_framebuffer_map(struct kms_framebuffer *fb, void **ptrp)
 	int err;
 
 	if (fb->ptr) {
+		fb->map_count++;
 		*ptrp = fb->ptr;
 		return 0;
 	}
@@ -234,16 +243,55 @@ int kms_framebuffer_map(struct kms_framebuffer *fb, void **ptrp)
 		return -errno;
 
 	*ptrp = fb->ptr = ptr;
+	fb->map_count = 1;
 
 	return 0;
 }
 
 void kms_framebuffer_unmap(struct kms_framebuffer *fb)
 {
+	if (!fb->map_count)
+		return;
+
+	if (!--fb->map_count && !fb->map_persistent)
+		kms_framebuffer_release_mapping(fb);
+}
+
+void kms_framebuffer_set_persistent(struct kms_framebuffer *fb, bool persistent)
+{
+	fb->map_persistent = persistent;
+
+	if (!persistent && !fb->map_count)
+		kms_framebuffer_release_mapping(fb);
+}
+
+/*
+ * Drop the drawing state cached by the draw API, for instance after the
+ * pixels were changed in a way it can't know about.
+ */
+void kms_framebuffer_release_draw_data(struct kms_framebuffer *fb)
+{
+	if (fb->draw_free) {
+		fb->draw_free(fb->draw_data);
+		fb->draw_free = NULL;
+		fb->draw_data = NULL;
+	}
+}
+
+/*
+ * Unmap the framebuffer whatever the number of users.
+ */
+void kms_framebuffer_release_mapping(struct kms_framebuffer *fb)
+{
+	/* drawing state points into the mapping */
+	kms_framebuffer_release_draw_data(fb);
+
 	if (fb->ptr) {
 		munmap(fb->ptr, fb->size);
 		fb->ptr = NULL;
 	}
+
+	fb->map_count = 0;
 }
 
 int kms_framebuffer_export(struct kms_framebuffer *fb, int *prime_fd)
@@ -268,3 +316,69 @@ int kms_framebuffer_export(struct kms_framebuffer *fb, int *prime_fd)
 
 	return 0;
 }
+
+static bool rect_contains(const struct drm_mode_rect *a,
+			  const struct drm_mode_rect *b)
+{
+	return a->x1 <= b->x1 && a->y1 <= b->y1 &&
+		a->x2 >= b->x2 && a->y2 >= b->y2;
+}
+
+static void rect_union(struct drm_mode_rect *a, const struct drm_mode_rect *b)
+{
+	if (b->x1 < a->x1)
+		a->x1 = b->x1;
+	if (b->y1 < a->y1)
+		a->y1 = b->y1;
+	if (b->x2 > a->x2)
+		a->x2 = b->x2;
+	if (b->y2 > a->y2)
+		a->y2 = b->y2;
+}
+
+void kms_damage_add(struct kms_damage *damage, const struct drm_mode_rect *rect)
+{
+	unsigned int i;
+
+	if (rect->x1 >= rect->x2 || rect->y1 >= rect->y2)
+		return;
+
+	for (i = 0; i < damage->count; i++)
+		if (rect_contains(&damage->rects[i], rect))
+			return;
+
+	if (damage->count < KMS_DAMAGE_MAX) {
+		damage->rects[damage->count++] = *rect;
+		return;
+	}
+
+	/* out of room, keep a single bounding box */
+	for (i = 1; i < damage->count; i++)
+		rect_union(&damage->rects[0], &damage->rects[i]);
+	rect_union(&damage->rects[0], rect);
+	damage->count = 1;
+}
+
+void kms_damage_merge(struct kms_damage *damage, const struct kms_damage *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < other->count; i++)
+		kms_damage_add(damage, &other->rects[i]);
+}
+
+/*
+ * Record a change of the framebuffer content, clipped to the framebuffer.
+ */
+void kms_framebuffer_damage(struct kms_framebuffer *fb, int x, int y,
+			    int width, int height)
+{
+	struct drm_mode_rect rect;
+
+	rect.x1 = x < 0 ? 0 : x;
+	rect.y1 = y < 0 ? 0 : y;
+	rect.x2 = x + width > (int)fb->width ? (int)fb->width : x + width;
+	rect.y2 = y + height > (int)fb->height ? (int)fb->height : y + height;
+
+	kms_damage_add(&fb->damage, &rect);
+}
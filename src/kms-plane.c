@@ -111,12 +111,16 @@ struct kms_plane *kms_plane_create(struct kms_device *device, uint32_t id)
 	plane->device = device;
 	plane->id = id;
 
-	plane->drm_obj = malloc(sizeof(*(plane->drm_obj)));
-	if (!plane->drm_obj) {
+	plane->drm_obj = calloc(1, sizeof(*(plane->drm_obj)));
+	plane->state = calloc(1, sizeof(*(plane->state)));
+	if (!plane->drm_obj || !plane->state) {
 		kms_plane_free(plane);
 		return NULL;
 	}
 
+	plane->state->in_fence = -1;
+	plane->state->fence_taken = -1;
+
 	plane->drm_obj->id = id;
 	drm_obj_get_properties(device->fd, plane->drm_obj, DRM_MODE_OBJECT_PLANE);
 
@@ -137,17 +141,26 @@ void kms_plane_free(struct kms_plane *plane)
 
 	drm_obj_free(plane->drm_obj);
 	free(plane->formats);
+	free(plane->state);
 	free(plane);
 }
 
-static int kms_plane_update(struct kms_plane *plane, struct kms_framebuffer *fb,
-			    uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h,
-			    int crtc_x, int crtc_y, int crtc_w, int crtc_h)
+#define PLANE_GEOMETRY_PROPS ((1u << DRM_OBJ_PROP_SRC_X) | \
+			      (1u << DRM_OBJ_PROP_SRC_Y) | \
+			      (1u << DRM_OBJ_PROP_SRC_W) | \
+			      (1u << DRM_OBJ_PROP_SRC_H) | \
+			      (1u << DRM_OBJ_PROP_CRTC_X) | \
+			      (1u << DRM_OBJ_PROP_CRTC_Y) | \
+			      (1u << DRM_OBJ_PROP_CRTC_W) | \
+			      (1u << DRM_OBJ_PROP_CRTC_H))
+
+/*
+ * Take the request lock and make sure there is a request to add properties to.
+ * On success, the caller must release req_lock.
+ */
+static int kms_device_lock_request(struct kms_device *device)
 {
-	struct kms_device *device = plane->device;
-	int fb_id = fb ? fb->id : 0;
-	int crtc_id = fb_id ? plane->crtc->id : 0;
-	int ret, mutex_ret;
+	int mutex_ret;
 
 	mutex_ret = pthread_mutex_lock(&device->req_lock);
 	if (mutex_ret) {
@@ -159,91 +172,421 @@ static int kms_plane_update(struct kms_plane *plane, struct kms_framebuffer *fb,
 		device->atomic_request = drmModeAtomicAlloc();
 		if (!device->atomic_request) {
 			LOG("error: drmModeAtomicAlloc failed\n");
-			ret = -ENOMEM;
-			goto out;
+			pthread_mutex_unlock(&device->req_lock);
+			return -ENOMEM;
 		}
 	}
 
-	LOG("kms_plane_update: fd_id=%d crtc_id=%d src_x=%d src_y=%d src_w=%d src_h=%d crtc_x=%d crtc_y=%d crtc_w=%d crtc_h=%d\n",
-		fb_id, crtc_id, src_x, src_y, src_w, src_h, crtc_x, crtc_y, crtc_w, crtc_h);
+	return 0;
+}
+
+static int kms_device_unlock_request(struct kms_device *device, int ret)
+{
+	int mutex_ret;
+
+	mutex_ret = pthread_mutex_unlock(&device->req_lock);
+	if (mutex_ret) {
+		LOG("error: pthread_mutex_unlock failed\n");
+		return mutex_ret;
+	}
+
+	return ret;
+}
+
+typedef int (*prop_setter)(drmModeAtomicReq *req, struct drm_object *obj,
+			   enum drm_obj_prop prop, uint64_t value);
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "FB_ID", fb_id);
+/*
+ * Add the framebuffer and geometry of the plane to req. The setter tells if
+ * properties are added unconditionally or only when they changed.
+ */
+static int kms_plane_add_state(struct kms_plane *plane, drmModeAtomicReq *req,
+			       prop_setter set, int fb_id, int crtc_id,
+			       uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h,
+			       int crtc_x, int crtc_y, int crtc_w, int crtc_h)
+{
+	int ret;
+
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_FB_ID, fb_id);
 	if (ret) {
 		LOG("error: can't set FB_ID property (%d)\n", ret);
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "CRTC_ID", crtc_id);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_CRTC_ID, crtc_id);
 	if (ret) {
 		LOG("error: can't set CRTC_ID property (%d)\n", ret);
-		goto property_error;
+		return ret;
 	}
 
 	if (!fb_id || !crtc_id)
-		goto out;
+		return 0;
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "SRC_X", src_x << 16);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_SRC_X, src_x << 16);
 	if (ret) {
 		LOG("error: can't set SRC_X property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "SRC_Y", src_y << 16);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_SRC_Y, src_y << 16);
 	if (ret) {
 		LOG("error: can't set SRC_Y property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "SRC_W", src_w << 16);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_SRC_W, src_w << 16);
 	if (ret) {
 		LOG("error: can't set SRC_W property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "SRC_H", src_h << 16);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_SRC_H, src_h << 16);
 	if (ret) {
 		LOG("error: can't set SRC_H property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "CRTC_X", crtc_x);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_CRTC_X, crtc_x);
 	if (ret) {
 		LOG("error: can't set CRTC_X property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "CRTC_Y", crtc_y);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_CRTC_Y, crtc_y);
 	if (ret) {
 		LOG("error: can't set CRTC_Y property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "CRTC_W", crtc_w);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_CRTC_W, crtc_w);
 	if (ret) {
 		LOG("error: can't set CRTC_W property\n");
-		goto property_error;
+		return ret;
 	}
 
-	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, "CRTC_H", crtc_h);
+	ret = set(req, plane->drm_obj, DRM_OBJ_PROP_CRTC_H, crtc_h);
 	if (ret) {
 		LOG("error: can't set CRTC_H property\n");
-		goto property_error;
+		return ret;
 	}
 
-property_error:
+	return 0;
+}
+
+/*
+ * Writers of plane->state. Producers of different planes never wait for each
+ * other, nor for kms_device_flush(). Two producers of the same plane do.
+ */
+static void kms_plane_state_begin(struct kms_plane_state *state)
+{
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&state->seq, __ATOMIC_RELAXED);
+	} while ((seq & 1) ||
+		 !__atomic_compare_exchange_n(&state->seq, &seq, seq + 1, true,
+					      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	/* the odd count must be visible before any of the values */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void kms_plane_state_write(struct kms_plane_state *state,
+				  enum drm_obj_prop prop, uint32_t value)
+{
+	__atomic_store_n(&state->values[prop], value, __ATOMIC_RELAXED);
+	__atomic_store_n(&state->set, state->set | (1u << prop), __ATOMIC_RELAXED);
+}
+
+static void kms_plane_state_end(struct kms_plane_state *state)
+{
+	__atomic_store_n(&state->seq, state->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy a consistent view of the state. Give up after a few attempts rather than
+ * wait for a producer.
+ */
+static bool kms_plane_state_read(struct kms_plane_state *state,
+				 uint32_t *values, uint32_t *set,
+				 unsigned int *seq)
+{
+	unsigned int tries, i, s1, s2;
+
+	for (tries = 0; tries < 4; tries++) {
+		s1 = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE);
+		if (s1 & 1)
+			continue;
+
+		for (i = 0; i < DRM_OBJ_PROP_COUNT; i++)
+			values[i] = __atomic_load_n(&state->values[i], __ATOMIC_RELAXED);
+		*set = __atomic_load_n(&state->set, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(&state->seq, __ATOMIC_RELAXED);
+
+		if (s1 == s2) {
+			*seq = s1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int kms_plane_update(struct kms_plane *plane, struct kms_framebuffer *fb,
+			    uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h,
+			    int crtc_x, int crtc_y, int crtc_w, int crtc_h)
+{
+	struct kms_plane_state *state = plane->state;
+	int fb_id = fb ? fb->id : 0;
+	int crtc_id = fb_id ? plane->crtc->id : 0;
+
+	LOG("kms_plane_update: fd_id=%d crtc_id=%d src_x=%d src_y=%d src_w=%d src_h=%d crtc_x=%d crtc_y=%d crtc_w=%d crtc_h=%d\n",
+		fb_id, crtc_id, src_x, src_y, src_w, src_h, crtc_x, crtc_y, crtc_w, crtc_h);
+
+	kms_plane_state_begin(state);
+
+	kms_plane_state_write(state, DRM_OBJ_PROP_FB_ID, fb_id);
+	kms_plane_state_write(state, DRM_OBJ_PROP_CRTC_ID, crtc_id);
+
+	if (fb_id && crtc_id) {
+		kms_plane_state_write(state, DRM_OBJ_PROP_SRC_X, src_x << 16);
+		kms_plane_state_write(state, DRM_OBJ_PROP_SRC_Y, src_y << 16);
+		kms_plane_state_write(state, DRM_OBJ_PROP_SRC_W, src_w << 16);
+		kms_plane_state_write(state, DRM_OBJ_PROP_SRC_H, src_h << 16);
+		kms_plane_state_write(state, DRM_OBJ_PROP_CRTC_X, crtc_x);
+		kms_plane_state_write(state, DRM_OBJ_PROP_CRTC_Y, crtc_y);
+		kms_plane_state_write(state, DRM_OBJ_PROP_CRTC_W, crtc_w);
+		kms_plane_state_write(state, DRM_OBJ_PROP_CRTC_H, crtc_h);
+	} else {
+		__atomic_store_n(&state->set, state->set & ~PLANE_GEOMETRY_PROPS,
+				 __ATOMIC_RELAXED);
+	}
+
+	kms_plane_state_end(state);
+
+	return 0;
+}
+
+int kms_plane_set_prop(struct kms_plane *plane, enum drm_obj_prop prop,
+		       uint64_t value)
+{
+	struct kms_plane_state *state = plane->state;
+
+	if (!drm_obj_has_prop(plane->drm_obj, prop)) {
+		LOG("error: plane 0x%x: property %d not found\n", plane->id, prop);
+		return -ENOENT;
+	}
+
+	kms_plane_state_begin(state);
+	kms_plane_state_write(state, prop, value);
+	kms_plane_state_end(state);
+
+	return 0;
+}
+
+/*
+ * Take the damage accumulated by the producers and add it to req. It only makes
+ * sense against the framebuffer already on screen, so it is dropped when the
+ * commit changes FB_ID: the whole plane is updated then.
+ */
+static int kms_plane_add_damage_clips(struct kms_plane *plane,
+				      drmModeAtomicReq *req, bool same_fb)
+{
+	struct kms_device *device = plane->device;
+	struct kms_plane_state *state = plane->state;
+	struct kms_damage damage;
+	uint32_t blob;
+	int ret;
+
+	if (!__atomic_load_n(&state->damage.count, __ATOMIC_RELAXED))
+		return 0;
+
+	/* the damage is written by producers like the values */
+	kms_plane_state_begin(state);
+	damage = state->damage;
+	state->damage.count = 0;
+	kms_plane_state_end(state);
+
+	if (!same_fb || !damage.count ||
+	    !drm_obj_has_prop(plane->drm_obj, DRM_OBJ_PROP_FB_DAMAGE_CLIPS))
+		return 0;
+
+	ret = drmModeCreatePropertyBlob(device->fd, damage.rects,
+					damage.count * sizeof(damage.rects[0]),
+					&blob);
 	if (ret) {
-		drmModeAtomicFree(device->atomic_request);
-		device->atomic_request = NULL;
+		LOG("error: can't create FB_DAMAGE_CLIPS blob (%d)\n", ret);
+		return ret;
 	}
 
-out:
-	mutex_ret = pthread_mutex_unlock(&device->req_lock);
-	if (mutex_ret) {
-		LOG("error: pthread_mutex_unlock failed\n");
-		ret = mutex_ret;
+	ret = drm_obj_set_prop(req, plane->drm_obj, DRM_OBJ_PROP_FB_DAMAGE_CLIPS,
+			       blob);
+	if (ret) {
+		LOG("error: can't set FB_DAMAGE_CLIPS property\n");
+		drmModeDestroyPropertyBlob(device->fd, blob);
+		return ret;
 	}
 
-	return ret;
+	/* the commit holds its own reference, ours goes once it is sent */
+	state->damage_blob = blob;
+	state->damage_taken = damage;
+
+	return 0;
+}
+
+/*
+ * Called once the request built by kms_plane_add_pending() has been sent, or
+ * given up on. What it took from the producers goes back to them if it never
+ * reached the kernel, so the retry has it.
+ */
+void kms_plane_end_commit(struct kms_plane *plane, bool committed)
+{
+	struct kms_plane_state *state = plane->state;
+	int none = -1;
+
+	if (state->damage_blob) {
+		drmModeDestroyPropertyBlob(plane->device->fd, state->damage_blob);
+		state->damage_blob = 0;
+
+		/* on top of what the producers added since */
+		if (!committed) {
+			kms_plane_state_begin(state);
+			kms_damage_merge(&state->damage, &state->damage_taken);
+			kms_plane_state_end(state);
+		}
+	}
+
+	if (state->fence_taken >= 0 && !committed &&
+	    !__atomic_compare_exchange_n(&state->in_fence, &none,
+					 state->fence_taken, false,
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		LOG("error: plane 0x%x: fence %d dropped\n", plane->id,
+		    state->fence_taken);
+
+	state->fence_taken = -1;
+}
+
+/*
+ * Add the state published by the producers of the plane to req. For a flush,
+ * only what changed since the last one is added. For a test, everything is.
+ */
+int kms_plane_add_pending(struct kms_plane *plane, drmModeAtomicReq *req,
+			  bool test)
+{
+	struct kms_plane_state *state = plane->state;
+	prop_setter set = test ? drm_obj_set_prop : drm_obj_update_prop;
+	uint32_t values[DRM_OBJ_PROP_COUNT];
+	uint32_t mask;
+	unsigned int seq, i;
+	bool same_fb;
+	int fence;
+	int ret;
+
+	/* a producer is busy, the next flush will pick its changes up */
+	if (!kms_plane_state_read(state, values, &mask, &seq))
+		return 0;
+
+	same_fb = values[DRM_OBJ_PROP_FB_ID] &&
+		(plane->drm_obj->prop_valid & (1u << DRM_OBJ_PROP_FB_ID)) &&
+		plane->drm_obj->prop_values[DRM_OBJ_PROP_FB_ID] ==
+		values[DRM_OBJ_PROP_FB_ID];
+
+	if (test || seq != state->flushed_seq || state->resync) {
+		for (i = 0; i < DRM_OBJ_PROP_COUNT; i++) {
+			uint64_t value = values[i];
+
+			if (!(mask & (1u << i)))
+				continue;
+
+			/* plane positions are signed */
+			if (i == DRM_OBJ_PROP_CRTC_X || i == DRM_OBJ_PROP_CRTC_Y)
+				value = (uint64_t)(int64_t)(int32_t)values[i];
+
+			ret = set(req, plane->drm_obj, i, value);
+			if (ret) {
+				LOG("error: plane 0x%x: can't set property %u (%d)\n",
+				    plane->id, i, ret);
+				return ret;
+			}
+		}
+
+		if (test)
+			return 0;
+
+		/* the geometry of a disabled plane is not worth keeping track of */
+		if (!values[DRM_OBJ_PROP_FB_ID])
+			drm_obj_invalidate_props(plane->drm_obj, PLANE_GEOMETRY_PROPS);
+
+		state->flushed_seq = seq;
+		state->resync = false;
+	}
+
+	fence = __atomic_exchange_n(&state->in_fence, -1, __ATOMIC_ACQUIRE);
+	if (fence >= 0) {
+		/* given back by kms_plane_end_commit() if the commit fails */
+		state->fence_taken = fence;
+
+		ret = drm_obj_set_prop(req, plane->drm_obj, DRM_OBJ_PROP_IN_FENCE_FD,
+				       (uint64_t)(int64_t)fence);
+		if (ret) {
+			LOG("error: can't set IN_FENCE_FD property\n");
+			return ret;
+		}
+	}
+
+	return kms_plane_add_damage_clips(plane, req, same_fb);
+}
+
+int kms_plane_set_property(struct kms_plane *plane, const char *name,
+			   uint64_t value)
+{
+	struct kms_device *device = plane->device;
+	int ret;
+
+	ret = kms_device_lock_request(device);
+	if (ret)
+		return ret;
+
+	ret = drm_obj_set_property(device->atomic_request, plane->drm_obj, name, value);
+
+	return kms_device_unlock_request(device, ret);
+}
+
+/*
+ * The fence only applies to the next commit, so it is never compared against
+ * the previous value: fd numbers are reused. A fence that hasn't been flushed
+ * yet is kept, the new one is refused.
+ */
+int kms_plane_set_in_fence(struct kms_plane *plane, int fence_fd)
+{
+	int none = -1;
+
+	if (!drm_obj_has_prop(plane->drm_obj, DRM_OBJ_PROP_IN_FENCE_FD)) {
+		LOG("error: plane 0x%x: no IN_FENCE_FD property\n", plane->id);
+		return -ENOENT;
+	}
+
+	if (!__atomic_compare_exchange_n(&plane->state->in_fence, &none,
+					 fence_fd, false, __ATOMIC_RELEASE,
+					 __ATOMIC_RELAXED))
+		return -EBUSY;
+
+	return 0;
+}
+
+/*
+ * Damage accumulates until a flush takes it.
+ */
+void kms_plane_add_damage(struct kms_plane *plane,
+			  const struct kms_damage *damage)
+{
+	struct kms_plane_state *state = plane->state;
+
+	kms_plane_state_begin(state);
+	kms_damage_merge(&state->damage, damage);
+	kms_plane_state_end(state);
 }
 
 int kms_plane_set(struct kms_plane *plane, struct kms_framebuffer *fb,
@@ -265,6 +608,61 @@ int kms_plane_set_pan(struct kms_plane *plane, struct kms_framebuffer *fb,
 	return kms_plane_update(plane, fb, px, py, pw, ph, x, y, w, h);
 }
 
+int kms_plane_check(struct kms_plane *plane, struct kms_framebuffer *fb,
+		    int x, int y, uint32_t px, uint32_t py, uint32_t pw,
+		    uint32_t ph, double scale_x, double scale_y,
+		    uint32_t rotation, uint32_t alpha)
+{
+	struct kms_device *device = plane->device;
+	int w = pw * scale_x;
+	int h = ph * scale_y;
+	uint32_t config[] = {
+		plane->id, plane->crtc->id, device->modeset_needed,
+		fb->width, fb->height, fb->format,
+		px, py, pw, ph, x, y, w, h,
+		rotation, alpha,
+	};
+	uint64_t key = kms_config_hash(config, ARRAY_SIZE(config));
+	drmModeAtomicReq *req;
+	int ret;
+
+	if (kms_device_test_lookup(device, key, &ret))
+		return ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	ret = kms_plane_add_state(plane, req, drm_obj_set_prop,
+				  fb->id, plane->crtc->id,
+				  px, py, pw, ph, x, y, w, h);
+	if (ret)
+		goto out;
+
+	/* rotation 0 is what a plane without the property does anyway */
+	if (drm_obj_has_prop(plane->drm_obj, DRM_OBJ_PROP_ROTATION))
+		ret = drm_obj_set_prop(req, plane->drm_obj, DRM_OBJ_PROP_ROTATION, rotation);
+	else if (rotation != 1)
+		ret = -EINVAL;
+	if (ret)
+		goto out;
+
+	if (plane->type != DRM_PLANE_TYPE_PRIMARY &&
+	    drm_obj_has_prop(plane->drm_obj, DRM_OBJ_PROP_ALPHA)) {
+		ret = drm_obj_set_prop(req, plane->drm_obj, DRM_OBJ_PROP_ALPHA, alpha);
+		if (ret)
+			goto out;
+	}
+
+	ret = kms_device_test_request(device, req);
+	kms_device_test_store(device, key, ret);
+
+out:
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
 bool kms_plane_supports_format(struct kms_plane *plane, uint32_t format)
 {
 	unsigned int i;
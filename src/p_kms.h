@@ -59,7 +59,15 @@ struct kms_framebuffer *kms_framebuffer_create(struct kms_device *device,
 void kms_framebuffer_free(struct kms_framebuffer *fb);
 int kms_framebuffer_map(struct kms_framebuffer *fb, void **ptrp);
 void kms_framebuffer_unmap(struct kms_framebuffer *fb);
+void kms_framebuffer_set_persistent(struct kms_framebuffer *fb, bool persistent);
+void kms_framebuffer_release_mapping(struct kms_framebuffer *fb);
+void kms_framebuffer_release_draw_data(struct kms_framebuffer *fb);
 int kms_framebuffer_export(struct kms_framebuffer *fb, int *prime_fd);
+void kms_framebuffer_damage(struct kms_framebuffer *fb, int x, int y,
+			    int width, int height);
+
+void kms_damage_add(struct kms_damage *damage, const struct drm_mode_rect *rect);
+void kms_damage_merge(struct kms_damage *damage, const struct kms_damage *other);
 
 struct kms_screen *kms_screen_create(struct kms_device *device, uint32_t id);
 void kms_screen_free(struct kms_screen *screen);
@@ -67,6 +75,31 @@ void kms_screen_free(struct kms_screen *screen);
 int kms_screen_set(struct kms_screen *screen, struct kms_crtc *crtc,
 		   struct kms_framebuffer *fb);
 
+/*
+ * Pending state of a plane. Producers publish it without taking req_lock, seq
+ * is odd while one of them writes. Property values are the raw 32 bit values,
+ * set tells which of them have been written.
+ */
+struct kms_plane_state {
+	unsigned int seq;
+	uint32_t set;
+	uint32_t values[DRM_OBJ_PROP_COUNT];
+	/* IN_FENCE_FD for the next commit, -1 if none */
+	int in_fence;
+	/* FB_DAMAGE_CLIPS for the next commit, written like the values */
+	struct kms_damage damage;
+
+	/* only used by the flusher, under req_lock */
+	unsigned int flushed_seq;
+	bool resync;
+	/* FB_DAMAGE_CLIPS blob of the commit in progress, 0 if none */
+	uint32_t damage_blob;
+	/* the damage in that blob */
+	struct kms_damage damage_taken;
+	/* IN_FENCE_FD of the commit in progress, -1 if none */
+	int fence_taken;
+};
+
 struct kms_plane *kms_plane_create(struct kms_device *device, uint32_t id);
 void kms_plane_free(struct kms_plane *plane);
 int kms_plane_remove(struct kms_plane *plane);
@@ -76,8 +109,29 @@ int kms_plane_set(struct kms_plane *plane, struct kms_framebuffer *fb,
 int kms_plane_set_pan(struct kms_plane *plane, struct kms_framebuffer *fb,
 		      int x, int y, uint32_t px, uint32_t py, uint32_t pw, uint32_t ph, double scale_x, double scale_y);
 bool kms_plane_supports_format(struct kms_plane *plane, uint32_t format);
+int kms_plane_check(struct kms_plane *plane, struct kms_framebuffer *fb,
+		    int x, int y, uint32_t px, uint32_t py, uint32_t pw,
+		    uint32_t ph, double scale_x, double scale_y,
+		    uint32_t rotation, uint32_t alpha);
+int kms_plane_set_prop(struct kms_plane *plane, enum drm_obj_prop prop,
+		       uint64_t value);
+int kms_plane_set_property(struct kms_plane *plane, const char *name,
+			   uint64_t value);
+int kms_plane_set_in_fence(struct kms_plane *plane, int fence_fd);
+void kms_plane_add_damage(struct kms_plane *plane,
+			  const struct kms_damage *damage);
+void kms_plane_end_commit(struct kms_plane *plane, bool committed);
+int kms_plane_add_pending(struct kms_plane *plane, drmModeAtomicReq *req,
+			  bool test);
 
 void kms_device_probe_framebuffers(struct kms_device *device);
+void kms_device_invalidate_state(struct kms_device *device);
+int kms_device_test_request(struct kms_device *device, drmModeAtomicReq *req);
+uint64_t kms_config_hash(const uint32_t *config, size_t count);
+bool kms_device_test_lookup(struct kms_device *device, uint64_t key, int *result);
+void kms_device_test_store(struct kms_device *device, uint64_t key, int result);
+int kms_commit_wait_retired(struct kms_device *device, unsigned int retired,
+			    int timeout_ms);
 
 const char* kms_format_str(uint32_t format);
 int kms_format_bpp(uint32_t format);
@@ -70,6 +70,59 @@ static uint32_t create_gem_name(struct kms_framebuffer* fb)
 	return flink.name;
 }
 
+#define FB_POOL_SIZE 32
+
+/* framebuffers of freed planes, for new planes to reuse */
+static struct kms_framebuffer* fb_pool[FB_POOL_SIZE];
+
+static struct kms_framebuffer* fb_pool_take(struct kms_device* device,
+					    int width, int height,
+					    uint32_t format)
+{
+	struct kms_framebuffer* fb;
+	unsigned int i;
+
+	for (i = 0; i < FB_POOL_SIZE; i++) {
+		fb = fb_pool[i];
+
+		if (fb && fb->device == device && fb->format == format &&
+		    fb->width == (unsigned int)width &&
+		    fb->height == (unsigned int)height) {
+			fb_pool[i] = NULL;
+			fb->damage.count = 0;
+			return fb;
+		}
+	}
+
+	return kms_framebuffer_create(device, width, height, format);
+}
+
+static void fb_pool_put(struct kms_framebuffer* fb)
+{
+	unsigned int i;
+
+	for (i = 0; i < FB_POOL_SIZE; i++) {
+		if (!fb_pool[i]) {
+			fb_pool[i] = fb;
+			return;
+		}
+	}
+
+	kms_framebuffer_free(fb);
+}
+
+void plane_fb_pool_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FB_POOL_SIZE; i++) {
+		if (fb_pool[i]) {
+			kms_framebuffer_free(fb_pool[i]);
+			fb_pool[i] = NULL;
+		}
+	}
+}
+
 struct plane_data* plane_create(struct kms_device* device, int type, int index,
 				int width, int height, uint32_t format)
 {
@@ -81,8 +134,15 @@ struct plane_data* plane_create_buffered(struct kms_device* device, int type,
 					 uint32_t format, uint32_t buffer_count)
 {
 	uint32_t fb;
+	struct plane_data* plane;
 
-	struct plane_data* plane = calloc(1, sizeof(struct plane_data));
+	/* the swapchain keeps track of framebuffers in 32 bit masks */
+	if (!buffer_count || buffer_count > 32) {
+		LOG("error: invalid buffer count %u\n", buffer_count);
+		return NULL;
+	}
+
+	plane = calloc(1, sizeof(struct plane_data));
 	if (!plane) {
 		LOG("error: failed to allocate plane\n");
 		goto abort;
@@ -92,8 +152,10 @@ struct plane_data* plane_create_buffered(struct kms_device* device, int type,
 	plane->bufs = calloc(buffer_count, sizeof(void*));
 	plane->prime_fds = calloc(buffer_count, sizeof(int));
 	plane->gem_names = calloc(buffer_count, sizeof(uint32_t*));
+	plane->queue_seqs = calloc(buffer_count, sizeof(unsigned int));
 
-	if (!plane->fbs || !plane->bufs || !plane->prime_fds || !plane->gem_names) {
+	if (!plane->fbs || !plane->bufs || !plane->prime_fds || !plane->gem_names ||
+	    !plane->queue_seqs) {
 		LOG("error: failed to allocate plane\n");
 		goto abort;
 	}
@@ -127,7 +189,7 @@ struct plane_data* plane_create_buffered(struct kms_device* device, int type,
 	    plane->plane->id, kms_format_str(format), width, height);
 
 	for (fb = 0; fb < plane->buffer_count; fb++) {
-		plane->fbs[fb] = kms_framebuffer_create(device, width, height, format);
+		plane->fbs[fb] = fb_pool_take(device, width, height, format);
 		if (!plane->fbs[fb]) {
 			LOG("error: failed to create fb\n");
 			goto abort;
@@ -176,7 +238,12 @@ static void plane_fb_free(struct plane_data* plane)
 
 void plane_free(struct plane_data* plane)
 {
+	unsigned int i;
+
 	if (plane) {
+		if (plane->engine_free)
+			plane->engine_free(plane->engine_data);
+
 		plane_fb_free(plane);
 
 		if (plane->fbs)
@@ -187,10 +254,35 @@ void plane_free(struct plane_data* plane)
 			free(plane->prime_fds);
 		if (plane->gem_names)
 			free(plane->gem_names);
+		if (plane->queue_seqs)
+			free(plane->queue_seqs);
+		for (i = 0; i < plane->text_count; i++)
+			free(plane->text[i].str);
+		free(plane->text);
 		free(plane);
 	}
 }
 
+void plane_free_pooled(struct plane_data* plane)
+{
+	uint32_t fb;
+
+	if (!plane)
+		return;
+
+	plane_fb_unmap(plane);
+	plane_fb_unexport(plane);
+
+	for (fb = 0; fb < plane->buffer_count; fb++) {
+		if (plane->fbs[fb]) {
+			fb_pool_put(plane->fbs[fb]);
+			plane->fbs[fb] = NULL;
+		}
+	}
+
+	plane_free(plane);
+}
+
 int plane_fb_reallocate(struct plane_data* plane,
 			int width, int height, uint32_t format)
 {
@@ -220,44 +312,10 @@ abort:
 	return -1;
 }
 
-static int set_plane_prop(struct kms_plane* plane, const char* name, uint32_t value)
-{
-	struct kms_device* device = plane->device;
-	drmModeObjectPropertiesPtr props;
-	unsigned int i;
-	int status = -1;
-
-	props = drmModeObjectGetProperties(device->fd, plane->id,
-					   DRM_MODE_OBJECT_PLANE);
-	if (!props)
-		return -ENODEV;
-
-	for (i = 0; i < props->count_props; i++) {
-		drmModePropertyPtr prop;
-
-		prop = drmModeGetProperty(device->fd, props->props[i]);
-		if (prop) {
-			if (strcmp(prop->name, name) == 0) {
-				status = drmModeObjectSetProperty(device->fd,
-								  plane->id,
-								  DRM_MODE_OBJECT_PLANE,
-								  prop->prop_id,
-								  value);
-			}
-
-			drmModeFreeProperty(prop);
-		}
-	}
-
-	drmModeFreeObjectProperties(props);
-
-	return status;
-}
-
 int plane_apply_rotate(struct plane_data* plane, uint32_t degrees)
 {
 	int rotate_index = degrees / 90;
-	if (set_plane_prop(plane->plane, "rotation", 1 << rotate_index)) {
+	if (kms_plane_set_prop(plane->plane, DRM_OBJ_PROP_ROTATION, 1 << rotate_index)) {
 		LOG("error: failed to apply plane rotate\n");
 		return -1;
 	}
@@ -273,7 +331,7 @@ int plane_apply_alpha(struct plane_data* plane, uint32_t alpha)
 	if (plane->plane->type == DRM_PLANE_TYPE_PRIMARY)
 		return -1;
 
-	if (set_plane_prop(plane->plane, "alpha", alpha)) {
+	if (kms_plane_set_prop(plane->plane, DRM_OBJ_PROP_ALPHA, alpha)) {
 		LOG("error: failed to apply plane alpha %d\n", alpha);
 		return -1;
 	}
@@ -284,6 +342,51 @@ int plane_apply_alpha(struct plane_data* plane, uint32_t alpha)
 	return 0;
 }
 
+int plane_apply_property(struct plane_data* plane, const char* name,
+			 uint32_t value)
+{
+	if (kms_plane_set_property(plane->plane, name, value)) {
+		LOG("error: failed to apply plane property %s\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+int plane_set_in_fence(struct plane_data* plane, int fence_fd)
+{
+	if (kms_plane_set_in_fence(plane->plane, fence_fd)) {
+		LOG("error: failed to set plane in fence %d\n", fence_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int plane_add_text(struct plane_data* plane, const char* str, int x, int y,
+		   uint32_t color, float size)
+{
+	struct plane_text* text;
+
+	text = realloc(plane->text, (plane->text_count + 1) * sizeof(*text));
+	if (!text)
+		return -1;
+	plane->text = text;
+
+	text = &plane->text[plane->text_count];
+	text->str = strdup(str);
+	if (!text->str)
+		return -1;
+
+	text->x = x;
+	text->y = y;
+	text->color = color;
+	text->size = size;
+	plane->text_count++;
+
+	return 0;
+}
+
 int plane_set_rotate(struct plane_data* plane, uint32_t degrees)
 {
 	if (plane->rotate_degrees % 90 ||
@@ -337,6 +440,19 @@ double plane_scale_y(struct plane_data* plane)
 	return plane->scale_y;
 }
 
+/*
+ * Hand what changed in the framebuffer on screen over to the next commit.
+ */
+static void plane_push_damage(struct plane_data* plane)
+{
+	struct kms_framebuffer* fb = plane->fbs[plane->front_buf];
+
+	if (fb->damage.count) {
+		kms_plane_add_damage(plane->plane, &fb->damage);
+		fb->damage.count = 0;
+	}
+}
+
 int plane_apply(struct plane_data* plane)
 {
 	struct kms_framebuffer* fb = plane->fbs[plane->front_buf];
@@ -347,6 +463,8 @@ int plane_apply(struct plane_data* plane)
 	if (plane->alpha != plane->alpha_applied)
 		plane_apply_alpha(plane, plane->alpha);
 
+	plane_push_damage(plane);
+
 	if (plane->pan.width && plane->pan.height) {
 		return kms_plane_set_pan(plane->plane, fb,
 					 plane->x, plane->y,
@@ -360,6 +478,24 @@ int plane_apply(struct plane_data* plane)
 			     plane->scale_x, plane->scale_y);
 }
 
+int plane_check(struct plane_data* plane)
+{
+	struct kms_framebuffer* fb = plane->fbs[plane->front_buf];
+	uint32_t px = 0, py = 0, pw = fb->width, ph = fb->height;
+
+	if (plane->pan.width && plane->pan.height) {
+		px = plane->pan.x;
+		py = plane->pan.y;
+		pw = plane->pan.width;
+		ph = plane->pan.height;
+	}
+
+	return kms_plane_check(plane->plane, fb, plane->x, plane->y,
+			       px, py, pw, ph,
+			       plane->scale_x, plane->scale_y,
+			       1 << (plane->rotate_degrees / 90), plane->alpha);
+}
+
 uint32_t plane_width(struct plane_data* plane)
 {
 	return plane->fbs[0]->width;
@@ -452,6 +588,22 @@ int plane_fb_map(struct plane_data* plane)
 	return 0;
 }
 
+void plane_fb_set_persistent(struct plane_data* plane, bool persistent)
+{
+	uint32_t fb;
+
+	for (fb = 0; fb < plane->buffer_count; fb++)
+		if (plane->fbs[fb])
+			kms_framebuffer_set_persistent(plane->fbs[fb], persistent);
+}
+
+void plane_fb_damage(struct plane_data* plane, uint32_t index, int x, int y,
+		     int width, int height)
+{
+	if (index < plane->buffer_count)
+		kms_framebuffer_damage(plane->fbs[index], x, y, width, height);
+}
+
 void plane_fb_unmap(struct plane_data* plane)
 {
 	uint32_t fb;
@@ -493,21 +645,191 @@ void plane_fb_unexport(struct plane_data* plane)
 		plane->prime_fds[fb] = -1;
 }
 
+/*
+ * Move the framebuffers latched by the hardware out of the queue. The most
+ * recently queued of them is the one on screen. Returns the retired_seq used.
+ */
+static unsigned int plane_retire(struct plane_data* plane)
+{
+	struct kms_device* device = plane->plane->device;
+	unsigned int retired;
+	unsigned int newest = 0;
+	bool found = false;
+	uint32_t fb;
+
+	/* the commit thread may update it at any time */
+	retired = __atomic_load_n(&device->retired_seq, __ATOMIC_ACQUIRE);
+
+	for (fb = 0; fb < plane->buffer_count; fb++) {
+		unsigned int seq = plane->queue_seqs[fb];
+
+		if (!(plane->queued & (1u << fb)) ||
+		    (int)(retired - seq) < 0)
+			continue;
+
+		if (!found || (int)(seq - newest) > 0) {
+			plane->scanout_buf = fb;
+			newest = seq;
+			found = true;
+		}
+
+		plane->queued &= ~(1u << fb);
+	}
+
+	return retired;
+}
+
+int plane_acquire(struct plane_data* plane)
+{
+	struct kms_device* device = plane->plane->device;
+	unsigned int retired;
+	uint32_t busy;
+	uint32_t fb;
+	int ret;
+
+	if (plane->buffer_count < 2)
+		return -EBUSY;
+
+	while (1) {
+		retired = plane_retire(plane);
+
+		busy = plane->acquired | plane->queued |
+			(1u << plane->front_buf) | (1u << plane->scanout_buf);
+
+		for (fb = 0; fb < plane->buffer_count; fb++) {
+			if (!(busy & (1u << fb))) {
+				plane->acquired |= 1u << fb;
+				return fb;
+			}
+		}
+
+		/* only the commit thread may read the events then */
+		if (device->commit_worker) {
+			ret = kms_commit_wait_retired(device, retired, 1000);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		/* waiting wouldn't free anything */
+		if (retired == device->commit_seq)
+			return -EBUSY;
+
+		ret = kms_device_wait_idle(device, 1000);
+		if (ret)
+			return ret;
+	}
+}
+
+int plane_queue(struct plane_data* plane, uint32_t index)
+{
+	if (index >= plane->buffer_count || !(plane->acquired & (1u << index)))
+		return -EINVAL;
+
+	plane->acquired &= ~(1u << index);
+
+	return plane_flip(plane, index);
+}
+
+void plane_release(struct plane_data* plane, uint32_t index)
+{
+	if (index < plane->buffer_count)
+		plane->acquired &= ~(1u << index);
+}
+
+int plane_fb_copy(struct plane_data* plane, uint32_t dst, uint32_t src)
+{
+	struct kms_framebuffer* dst_fb;
+	struct kms_framebuffer* src_fb;
+	void* dst_ptr;
+	void* src_ptr;
+	int err;
+
+	if (dst >= plane->buffer_count || src >= plane->buffer_count)
+		return -EINVAL;
+
+	if (dst == src)
+		return 0;
+
+	dst_fb = plane->fbs[dst];
+	src_fb = plane->fbs[src];
+
+	err = kms_framebuffer_map(dst_fb, &dst_ptr);
+	if (err < 0) {
+		LOG("error: kms_framebuffer_map() failed: %s\n",
+		    strerror(-err));
+		return err;
+	}
+
+	err = kms_framebuffer_map(src_fb, &src_ptr);
+	if (err < 0) {
+		LOG("error: kms_framebuffer_map() failed: %s\n",
+		    strerror(-err));
+		kms_framebuffer_unmap(dst_fb);
+		return err;
+	}
+
+	memcpy(dst_ptr, src_ptr, dst_fb->size < src_fb->size ?
+	       dst_fb->size : src_fb->size);
+
+	/* a converted copy kept by the draw API is out of date */
+	kms_framebuffer_release_draw_data(dst_fb);
+	kms_framebuffer_damage(dst_fb, 0, 0, dst_fb->width, dst_fb->height);
+
+	kms_framebuffer_unmap(src_fb);
+	kms_framebuffer_unmap(dst_fb);
+
+	return 0;
+}
+
 int plane_flip(struct plane_data* plane, uint32_t target)
 {
+	struct kms_device* device = plane->plane->device;
+	unsigned int seq;
+	uint32_t fb;
+	int ret;
+
+	if (target >= plane->buffer_count)
+		return -EINVAL;
+
+	/*
+	 * Hold off the flusher, so that the state staged here goes in the
+	 * commit following commit_seq and not in the one being built.
+	 */
+	ret = pthread_mutex_lock(&device->req_lock);
+	if (ret) {
+		LOG("error: pthread_mutex_lock failed\n");
+		return -ret;
+	}
+
+	seq = device->commit_seq + 1;
+
+	/* a buffer queued for the same commit is replaced and never shown */
+	for (fb = 0; fb < plane->buffer_count; fb++)
+		if ((plane->queued & (1u << fb)) && plane->queue_seqs[fb] == seq)
+			plane->queued &= ~(1u << fb);
+
 	plane->front_buf = target;
+	plane->queued |= 1u << target;
+	plane->queue_seqs[target] = seq;
+
+	plane_push_damage(plane);
 
 	if (plane->pan.width && plane->pan.height) {
-		return kms_plane_set_pan(plane->plane, plane->fbs[plane->front_buf],
-					 plane->x, plane->y,
-					 plane->pan.x, plane->pan.y,
-					 plane->pan.width, plane->pan.height,
-					 plane->scale_x, plane->scale_y);
+		ret = kms_plane_set_pan(plane->plane, plane->fbs[plane->front_buf],
+					plane->x, plane->y,
+					plane->pan.x, plane->pan.y,
+					plane->pan.width, plane->pan.height,
+					plane->scale_x, plane->scale_y);
+	} else {
+		ret = kms_plane_set(plane->plane, plane->fbs[plane->front_buf],
+				    plane->x, plane->y,
+				    plane->scale_x, plane->scale_y);
 	}
 
-	return kms_plane_set(plane->plane, plane->fbs[plane->front_buf],
-			     plane->x, plane->y,
-			     plane->scale_x, plane->scale_y);
+	pthread_mutex_unlock(&device->req_lock);
+
+	return ret;
 }
 
 int plane_flip_async(struct plane_data* plane, uint32_t target)
@@ -110,6 +110,12 @@ void script_setvar(const char *name, double value)
 	lua_setglobal(state, name);
 }
 
+void script_setptr(const char *name, void *ptr)
+{
+	lua_pushlightuserdata(state, ptr);
+	lua_setglobal(state, name);
+}
+
 void script_setfunc(const char *name, SCRIPT_CALLBACK callback)
 {
 	lua_register(state, name, callback);
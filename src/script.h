@@ -32,6 +32,7 @@ int script_load(const char *expr, char **pmsg);
 double script_eval(int cookie, char **pmsg);
 void script_unref(int cookie);
 void script_setvar(const char *name, double value);
+void script_setptr(const char *name, void *ptr);
 double script_getvar(const char *name);
 
 typedef int (*SCRIPT_CALLBACK)(lua_State*);